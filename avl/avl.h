@@ -20,9 +20,49 @@
 
 struct avl_node {
 	struct avl_node *link[2];
+#ifdef AVL_THREADED
+	struct avl_node *thr[2];	/* in order prev and next */
+#endif
 	int height;
+#ifdef AVL_AUGMENT
+	int size;			/* nodes in this subtree */
+#endif
+};
+
+/*
+ * With AVL_AUGMENT every node knows the size of its subtree, which
+ * gives avl_rank, avl_select and avl_count in O(log n). A tree can
+ * also keep an aggregate of its own: aug is called on a node whenever
+ * its children changed, after they are up to date, and computes
+ * whatever it wants from them into the struct the node is in. Only
+ * the avl_tree functions know about aug, the ones that take a bare
+ * root keep the sizes right but leave the aggregates alone.
+ */
+typedef void(*avl_aug_fn)(struct avl_node *);
+
+/*
+ * A tree that keeps track of its smallest node, for when the tree is
+ * a queue. With AVL_THREADED every node also knows its neighbours in
+ * order, avl_next and avl_prev are one load.
+ */
+struct avl_tree {
+	struct avl_node *root;
+	struct avl_node *min;
+#ifdef AVL_AUGMENT
+	avl_aug_fn aug;
+#endif
 };
 
+#define AVL_TREE_INITIALIZER { NULL, NULL }
+#define avl_tree_min(t) ((t)->min)
+#ifdef AVL_THREADED
+#define avl_next(n) ((n)->thr[1])
+#define avl_prev(n) ((n)->thr[0])
+#endif
+#ifdef AVL_AUGMENT
+#define avl_size(n) ((n) != NULL ? (n)->size : 0)
+#endif
+
 typedef int(*avl_comp_fn)(const struct avl_node *, const struct avl_node *);
 typedef int(*avl_walk_fn)(struct avl_node *, void *);
 
@@ -55,14 +95,224 @@ struct avl_node *avl_lookup(const struct avl_node *, struct avl_node **, avl_com
 struct avl_node *avl_search(const struct avl_node *, struct avl_node **, avl_comp_fn);
 void avl_check(struct avl_node *, avl_comp_fn);
 
+void avl_tree_insert(struct avl_tree *, struct avl_node *, avl_comp_fn);
+void avl_tree_delete(struct avl_tree *, struct avl_node *, avl_comp_fn);
+void avl_tree_check(struct avl_tree *, avl_comp_fn);
+
+struct avl_node *avl_build_sorted(struct avl_node **, int);
+struct avl_node *avl_join(struct avl_node *, struct avl_node *, struct avl_node *);
+void avl_split(struct avl_node **, const struct avl_node *, avl_comp_fn,
+    struct avl_node **, struct avl_node **);
+void avl_tree_build_sorted(struct avl_tree *, struct avl_node **, int);
+void avl_tree_split(struct avl_tree *, const struct avl_node *, avl_comp_fn,
+    struct avl_tree *);
+void avl_tree_join(struct avl_tree *, struct avl_node *, struct avl_tree *);
+
+#ifdef AVL_AUGMENT
+int avl_rank(const struct avl_node *, struct avl_node **, avl_comp_fn);
+struct avl_node *avl_select(struct avl_node **, int);
+int avl_count(const struct avl_node *, const struct avl_node *,
+    struct avl_node **, avl_comp_fn);
+#endif
+
 void avl_it_init(struct avl_it *, struct avl_node *, struct avl_node *,
     struct avl_node *, avl_comp_fn);
 void avl_it_init2(struct avl_it *, struct avl_node *, struct avl_node *,
     struct avl_node *, int, avl_comp_fn);
 struct avl_node *avl_it_next(struct avl_it *);
 
+/* For AVL_GENERATE. */
+void avl_link_internal(struct avl_tree *, struct avl_node *, struct avl_node **,
+    struct avl_node ***, int, struct avl_node **);
+void avl_unlink_internal(struct avl_tree *, struct avl_node *, struct avl_node **,
+    struct avl_node ***, int);
+
 #ifdef __cplusplus
 }
 #endif
 
+#ifndef AVL_UNUSED
+#define AVL_UNUSED __attribute__((__unused__))
+#endif
+
+/*
+ * The same operations with the compare inlined, generated for one
+ * type like the heaps in heap.h. cmp compares two type *, field is
+ * the struct avl_node in type. The trees are the same trees, the
+ * function pointer versions and these can be mixed on one tree as
+ * long as the compare functions agree.
+ *
+ *	AVL_PROTOTYPE(name, type, field, cmp, funprefix)
+ *	AVL_GENERATE(name, type, field, cmp, funprefix)
+ */
+#define AVL_INSERT(name, root, el) name##_AVL_INSERT(root, el)
+#define AVL_DELETE(name, root, el) name##_AVL_DELETE(root, el)
+#define AVL_LOOKUP(name, root, el) name##_AVL_LOOKUP(root, el)
+#define AVL_SEARCH(name, root, el) name##_AVL_SEARCH(root, el)
+#define AVL_TREE_INSERT(name, t, el) name##_AVL_TREE_INSERT(t, el)
+#define AVL_TREE_DELETE(name, t, el) name##_AVL_TREE_DELETE(t, el)
+#define AVL_IT_INIT(name, it, root, s, e, ince) name##_AVL_IT_INIT(it, root, s, e, ince)
+#define AVL_IT_NEXT(name, it) name##_AVL_IT_NEXT(it)
+
+#define AVL_PROTOTYPE(name, type, field, cmp, funprefix)		\
+funprefix void name##_AVL_INSERT(struct avl_node **, type *);		\
+funprefix void name##_AVL_DELETE(struct avl_node **, type *);		\
+funprefix type *name##_AVL_LOOKUP(struct avl_node **, const type *);	\
+funprefix type *name##_AVL_SEARCH(struct avl_node **, const type *);	\
+funprefix void name##_AVL_TREE_INSERT(struct avl_tree *, type *);	\
+funprefix void name##_AVL_TREE_DELETE(struct avl_tree *, type *);	\
+funprefix void name##_AVL_IT_INIT(struct avl_it *, struct avl_node *,	\
+    type *, type *, int);						\
+funprefix type *name##_AVL_IT_NEXT(struct avl_it *);
+
+#define AVL_GENERATE(name, type, field, cmp, funprefix)			\
+AVL_UNUSED static inline void						\
+name##_AVL_DO_INSERT(struct avl_tree *t, struct avl_node **p, type *el)	\
+{									\
+	struct avl_node **path[AVL_MAXDEPTH];				\
+	struct avl_node *n, *nb[2] = { NULL, NULL };			\
+	int depth = 0, d;						\
+									\
+	while ((n = *p) != NULL) {					\
+		path[depth++] = p;					\
+		d = cmp(el, avl_data(n, type, field)) > 0;		\
+		nb[!d] = n;						\
+		p = &n->link[d];					\
+	}								\
+	avl_link_internal(t, &el->field, p, path, depth, nb);		\
+}									\
+									\
+AVL_UNUSED static inline void						\
+name##_AVL_DO_DELETE(struct avl_tree *t, struct avl_node **p, type *el)	\
+{									\
+	struct avl_node **path[AVL_MAXDEPTH];				\
+	struct avl_node *n;						\
+	int depth = 0;							\
+									\
+	while ((n = *p) != &el->field) {				\
+		if (n == NULL)						\
+			return;						\
+		path[depth++] = p;					\
+		p = &n->link[cmp(el, avl_data(n, type, field)) > 0];	\
+	}								\
+	avl_unlink_internal(t, n, p, path, depth);			\
+}									\
+									\
+AVL_UNUSED funprefix void						\
+name##_AVL_INSERT(struct avl_node **root, type *el)			\
+{									\
+	name##_AVL_DO_INSERT(NULL, root, el);				\
+}									\
+									\
+AVL_UNUSED funprefix void						\
+name##_AVL_DELETE(struct avl_node **root, type *el)			\
+{									\
+	name##_AVL_DO_DELETE(NULL, root, el);				\
+}									\
+									\
+AVL_UNUSED funprefix void						\
+name##_AVL_TREE_INSERT(struct avl_tree *t, type *el)			\
+{									\
+	name##_AVL_DO_INSERT(t, &t->root, el);				\
+}									\
+									\
+AVL_UNUSED funprefix void						\
+name##_AVL_TREE_DELETE(struct avl_tree *t, type *el)			\
+{									\
+	name##_AVL_DO_DELETE(t, &t->root, el);				\
+}									\
+									\
+AVL_UNUSED funprefix type *						\
+name##_AVL_LOOKUP(struct avl_node **root, const type *el)		\
+{									\
+	struct avl_node *n = *root;					\
+	int d;								\
+									\
+	while (n != NULL) {						\
+		if ((d = cmp(el, avl_data(n, type, field))) == 0)	\
+			return avl_data(n, type, field);		\
+		n = n->link[d > 0];					\
+	}								\
+	return NULL;							\
+}									\
+									\
+/*									\
+ * Return the best greater or equal match.				\
+ */									\
+AVL_UNUSED funprefix type *						\
+name##_AVL_SEARCH(struct avl_node **root, const type *el)		\
+{									\
+	struct avl_node *n = *root, *best = NULL;			\
+	int d;								\
+									\
+	while (n != NULL) {						\
+		if ((d = cmp(el, avl_data(n, type, field))) == 0)	\
+			return avl_data(n, type, field);		\
+		if (d < 0)						\
+			best = n;					\
+		n = n->link[d > 0];					\
+	}								\
+	return best ? avl_data(best, type, field) : NULL;		\
+}									\
+									\
+AVL_UNUSED funprefix void						\
+name##_AVL_IT_INIT(struct avl_it *it, struct avl_node *root, type *s,	\
+    type *e, int ince)							\
+{									\
+	avl_it_init2(it, root, s ? &s->field : NULL,			\
+	    e ? &e->field : NULL, ince, NULL);				\
+}									\
+									\
+/*									\
+ * avl_it_next with the compare inlined.				\
+ */									\
+AVL_UNUSED funprefix type *						\
+name##_AVL_IT_NEXT(struct avl_it *it)					\
+{									\
+	type *s = it->s ? avl_data(it->s, type, field) : NULL;		\
+	type *e = it->e ? avl_data(it->e, type, field) : NULL;		\
+									\
+	while (it->isp >= &it->is[0]) {					\
+		struct avl_it_int *is = it->isp;			\
+		struct avl_node *n = is->n;				\
+		type *el = avl_data(n, type, field);			\
+									\
+		switch (is->d) {					\
+		case 0:							\
+			if (e && (it->ince ? cmp(el, e) > 0 :		\
+			    cmp(el, e) >= 0))				\
+				is->d = 3;				\
+			else						\
+				is->d = 2;				\
+			if (s == NULL || cmp(el, s) >= 0) {		\
+				if (is->d == 2)				\
+					is->d = 1;			\
+				if (n->link[0]) {			\
+					it->isp++;			\
+					it->isp->n = n->link[0];	\
+					it->isp->d = 0;			\
+					continue;			\
+				}					\
+			}						\
+			continue;					\
+		case 1:							\
+			is->d = 2;					\
+			return el;					\
+		case 2:							\
+			if (n->link[1]) {				\
+				is->n = n->link[1];			\
+				is->d = 0;				\
+				continue;				\
+			}						\
+			is->d = 3;					\
+			continue;					\
+		case 3:							\
+			it->isp--;					\
+			continue;					\
+		}							\
+	}								\
+	return NULL;							\
+}
+
+
 #endif
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef __AVL_RCU_H__
+#define __AVL_RCU_H__
+
+#include <pthread.h>
+
+#include "avl.h"
+
+/*
+ * An avl tree that readers walk without locks while writers change it
+ * behind a mutex.
+ *
+ * The writers are the normal avl functions, they publish a node into
+ * the tree with a release store so a reader never sees a node before
+ * it's all there. A rotation can still move a node out from under a
+ * reader and make it miss what it's looking for, so the writers bump
+ * a sequence number around every change and a reader that didn't find
+ * anything, or needs to know that what it found is the best match,
+ * checks it and walks again. Finding the node it looked for needs no
+ * check, the node was in the tree while we walked.
+ *
+ * Nodes are never freed by the tree. A reader is inside
+ * avl_rcu_read_enter/avl_rcu_read_leave, after a node was deleted
+ * avl_rcu_synchronize waits until every reader that could have seen
+ * it has left, then it can be freed or its key changed. The compare
+ * function runs on nodes that are being deleted and inserted, it must
+ * only read the key.
+ *
+ * Every reader thread has a struct avl_rcu_reader, registered once.
+ */
+
+#define AVL_RCU_CACHELINE	64
+
+struct avl_rcu_reader {
+	unsigned long epoch;		/* 0 when outside */
+	struct avl_rcu_reader *next;
+} __attribute__((__aligned__(AVL_RCU_CACHELINE)));
+
+struct avl_rcu {
+	struct avl_tree tree;
+	pthread_mutex_t lock;
+	unsigned long seq __attribute__((__aligned__(AVL_RCU_CACHELINE)));
+	unsigned long epoch __attribute__((__aligned__(AVL_RCU_CACHELINE)));
+	pthread_mutex_t rlock;		/* readers */
+	struct avl_rcu_reader *readers;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void avl_rcu_init(struct avl_rcu *);
+void avl_rcu_destroy(struct avl_rcu *);
+void avl_rcu_register(struct avl_rcu *, struct avl_rcu_reader *);
+void avl_rcu_unregister(struct avl_rcu *, struct avl_rcu_reader *);
+
+void avl_rcu_insert(struct avl_rcu *, struct avl_node *, avl_comp_fn);
+void avl_rcu_delete(struct avl_rcu *, struct avl_node *, avl_comp_fn);
+void avl_rcu_synchronize(struct avl_rcu *);
+
+struct avl_node *avl_rcu_lookup(struct avl_rcu *, const struct avl_node *, avl_comp_fn);
+struct avl_node *avl_rcu_search(struct avl_rcu *, const struct avl_node *, avl_comp_fn);
+struct avl_node *avl_rcu_next(struct avl_rcu *, const struct avl_node *, avl_comp_fn);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * The epoch has to be visible before we look at the tree, that takes
+ * a full fence.
+ */
+static inline void
+avl_rcu_read_enter(struct avl_rcu *r, struct avl_rcu_reader *rd)
+{
+	__atomic_store_n(&rd->epoch, __atomic_load_n(&r->epoch, __ATOMIC_RELAXED),
+	    __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void
+avl_rcu_read_leave(struct avl_rcu *r, struct avl_rcu_reader *rd)
+{
+	__atomic_store_n(&rd->epoch, 0, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,307 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "avl.h"
+#include "avl_rcu.h"
+
+/*
+ * Read mostly avl for many threads. Every thread looks up random keys
+ * and 5% of the time it deletes one of its own elements and puts it
+ * back. The same tree behind a mutex, behind a rwlock and with
+ * avl_rcu. We report lookups per second for a growing number of
+ * threads.
+ *
+ * The avl_rcu writer waits for the readers before it reinserts, that's
+ * what a writer that frees or rekeys the element would have to do.
+ *
+ * Writers only touch the odd elements, the even ones stay in the tree
+ * and every lookup of them has to find them.
+ */
+
+struct el {
+	struct avl_node link;
+	int key;
+};
+
+static int
+el_cmp(const struct avl_node *an, const struct avl_node *bn)
+{
+	const struct el *a = avl_data(an, struct el, link);
+	const struct el *b = avl_data(bn, struct el, link);
+
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return (a > b) - (a < b);
+}
+
+static int
+el_key_cmp(const struct avl_node *an, const struct avl_node *bn)
+{
+	const struct el *a = avl_data(an, struct el, link);
+	const struct el *b = avl_data(bn, struct el, link);
+
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+static inline uint32_t
+thr_random(void)
+{
+	static __thread uint32_t x;
+
+	if (x == 0)
+		x = (uint32_t)(uintptr_t)&x | 1;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+struct avl_node *mtx_root;
+pthread_mutex_t mtx_lock = PTHREAD_MUTEX_INITIALIZER;
+struct avl_node *rw_root;
+pthread_rwlock_t rw_lock = PTHREAD_RWLOCK_INITIALIZER;
+struct avl_rcu rcu;
+
+struct variant {
+	const char *name;
+	void (*insert)(struct el *);
+	int (*lookup)(struct avl_rcu_reader *, int);
+	void (*update)(struct el *);
+};
+
+static void
+mtx_insert(struct el *el)
+{
+	avl_insert(&el->link, &mtx_root, el_cmp);
+}
+
+static int
+mtx_lookup(struct avl_rcu_reader *rd, int key)
+{
+	struct el s;
+	int found;
+
+	s.key = key;
+	pthread_mutex_lock(&mtx_lock);
+	found = avl_lookup(&s.link, &mtx_root, el_key_cmp) != NULL;
+	pthread_mutex_unlock(&mtx_lock);
+	return found;
+}
+
+static void
+mtx_update(struct el *el)
+{
+	pthread_mutex_lock(&mtx_lock);
+	avl_delete(&el->link, &mtx_root, el_cmp);
+	avl_insert(&el->link, &mtx_root, el_cmp);
+	pthread_mutex_unlock(&mtx_lock);
+}
+
+static void
+rw_insert(struct el *el)
+{
+	avl_insert(&el->link, &rw_root, el_cmp);
+}
+
+static int
+rw_lookup(struct avl_rcu_reader *rd, int key)
+{
+	struct el s;
+	int found;
+
+	s.key = key;
+	pthread_rwlock_rdlock(&rw_lock);
+	found = avl_lookup(&s.link, &rw_root, el_key_cmp) != NULL;
+	pthread_rwlock_unlock(&rw_lock);
+	return found;
+}
+
+static void
+rw_update(struct el *el)
+{
+	pthread_rwlock_wrlock(&rw_lock);
+	avl_delete(&el->link, &rw_root, el_cmp);
+	avl_insert(&el->link, &rw_root, el_cmp);
+	pthread_rwlock_unlock(&rw_lock);
+}
+
+static void
+rcu_insert(struct el *el)
+{
+	avl_rcu_insert(&rcu, &el->link, el_cmp);
+}
+
+static int
+rcu_lookup(struct avl_rcu_reader *rd, int key)
+{
+	struct el s;
+	int found;
+
+	s.key = key;
+	avl_rcu_read_enter(&rcu, rd);
+	found = avl_rcu_lookup(&rcu, &s.link, el_key_cmp) != NULL;
+	avl_rcu_read_leave(&rcu, rd);
+	return found;
+}
+
+static void
+rcu_update(struct el *el)
+{
+	avl_rcu_delete(&rcu, &el->link, el_cmp);
+	avl_rcu_synchronize(&rcu);
+	avl_rcu_insert(&rcu, &el->link, el_cmp);
+}
+
+struct variant variants[] = {
+	{ "mutex", mtx_insert, mtx_lookup, mtx_update },
+	{ "rwlock", rw_insert, rw_lookup, rw_update },
+	{ "rcu", rcu_insert, rcu_lookup, rcu_update },
+};
+
+struct thr {
+	pthread_t t;
+	const struct variant *v;
+	struct el *elems;
+	int nelem;
+	int all;
+	int nops;
+	long reads;
+};
+
+static volatile int go;
+
+static void *
+thr_run(void *arg)
+{
+	struct thr *t = arg;
+	const struct variant *v = t->v;
+	struct avl_rcu_reader rd;
+	int i, k;
+
+	avl_rcu_register(&rcu, &rd);
+	while (!go)
+		;
+
+	for (i = 0; i < t->nops; i++) {
+		if (thr_random() % 100 < 5) {
+			v->update(&t->elems[(thr_random() % (t->nelem / 2)) * 2 + 1]);
+		} else {
+			k = thr_random() % t->all;
+			if (!v->lookup(&rd, k * 2) && (k & 1) == 0)
+				errx(1, "%s: lookup lost element %d", v->name, k);
+			t->reads++;
+		}
+	}
+	avl_rcu_unregister(&rcu, &rd);
+	return NULL;
+}
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static double
+run_one(const struct variant *v, int nthreads, int nelem, int nops)
+{
+	struct thr *thr;
+	struct el *elems;
+	double start, elapsed;
+	int per = (nelem / nthreads) & ~1;	/* even, see thr_run */
+	long reads = 0;
+	int i;
+
+	if ((elems = calloc(nelem, sizeof(*elems))) == NULL)
+		err(1, "calloc");
+	if ((thr = calloc(nthreads, sizeof(*thr))) == NULL)
+		err(1, "calloc");
+
+	mtx_root = rw_root = NULL;
+	avl_rcu_init(&rcu);
+	for (i = 0; i < nelem; i++) {
+		elems[i].key = i * 2;
+		v->insert(&elems[i]);
+	}
+
+	go = 0;
+	for (i = 0; i < nthreads; i++) {
+		thr[i].v = v;
+		thr[i].elems = &elems[i * per];
+		thr[i].nelem = per;
+		thr[i].all = nelem;
+		thr[i].nops = nops / nthreads;
+		if (pthread_create(&thr[i].t, NULL, thr_run, &thr[i]))
+			errx(1, "pthread_create");
+	}
+	start = now_sec();
+	go = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(thr[i].t, NULL);
+		reads += thr[i].reads;
+	}
+	elapsed = now_sec() - start;
+
+	avl_rcu_destroy(&rcu);
+	free(thr);
+	free(elems);
+
+	return reads / elapsed;
+}
+
+#ifndef nitems
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+#endif
+int threads[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: avl_rcu_test [-e nelem] [-o nops]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	int nelem = 1000000, nops = 4000000;
+	int i, j, ch;
+
+	while ((ch = getopt(argc, argv, "e:o:")) != -1) {
+		switch (ch) {
+		case 'e':
+			nelem = atoi(optarg);
+			break;
+		case 'o':
+			nops = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	printf("# threads, then lookups per second of");
+	for (j = 0; j < nitems(variants); j++)
+		printf(" %s", variants[j].name);
+	printf("\n");
+	for (i = 0; i < nitems(threads); i++) {
+		if (nelem / threads[i] < 2)
+			break;
+		printf("%d", threads[i]);
+		for (j = 0; j < nitems(variants); j++)
+			printf(" %f", run_one(&variants[j], threads[i], nelem, nops));
+		printf("\n");
+		fflush(stdout);
+	}
+
+	return 0;
+}
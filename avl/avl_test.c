@@ -0,0 +1,557 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avl.h"
+#include "iavl.h"
+#include "bench.h"
+
+/*
+ * The avl through the function pointer against AVL_GENERATE with the
+ * same compare inlined and against IAVL, where an element is 8 bytes
+ * of node and the key instead of 24 and the key. Random keys are
+ * inserted, looked up in random order, walked with the iterator and
+ * deleted in random order. The numbers are ns per operation for
+ * insert lookup scan delete of each.
+ *
+ * Small trees are done many times over so that every size does about
+ * the same number of operations.
+ */
+
+struct el {
+	struct avl_node link;
+	int key;
+};
+
+static inline int
+el_cmp(const struct el *a, const struct el *b)
+{
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return (a > b) - (a < b);
+}
+
+static int
+el_node_cmp(const struct avl_node *a, const struct avl_node *b)
+{
+	return el_cmp(avl_data(a, struct el, link), avl_data(b, struct el, link));
+}
+
+AVL_PROTOTYPE(el, struct el, link, el_cmp, static)
+AVL_GENERATE(el, struct el, link, el_cmp, static)
+
+struct iel {
+	struct iavl_node link;
+	int key;
+};
+
+static inline int
+iel_cmp(const struct iel *a, const struct iel *b)
+{
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return (a > b) - (a < b);
+}
+
+IAVL_PROTOTYPE(iel, struct iel, link, iel_cmp, static)
+IAVL_GENERATE(iel, struct iel, link, iel_cmp, static)
+
+struct result {
+	double ins, look, scan, del;
+};
+
+static void
+shuffle(int *order, int n)
+{
+	int i, j, t;
+
+	for (i = n - 1; i > 0; i--) {
+		j = bench_random_uniform(i + 1);
+		t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+}
+
+static void
+run_fn(struct el *elems, const int *order, int n, struct result *r)
+{
+	struct avl_node *root = NULL;
+	struct avl_it it;
+	uint64_t start;
+	int i, found = 0;
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		avl_insert(&elems[i].link, &root, el_node_cmp);
+	r->ins += bench_ns(bench_since(start));
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		found += avl_lookup(&elems[order[i]].link, &root, el_node_cmp) != NULL;
+	r->look += bench_ns(bench_since(start));
+	assert(found == n);
+
+	start = bench_now();
+	avl_it_init(&it, root, NULL, NULL, el_node_cmp);
+	for (i = 0; avl_it_next(&it) != NULL; i++)
+		;
+	r->scan += bench_ns(bench_since(start));
+	assert(i == n);
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		avl_delete(&elems[order[i]].link, &root, el_node_cmp);
+	r->del += bench_ns(bench_since(start));
+	assert(root == NULL);
+}
+
+static void
+run_gen(struct el *elems, const int *order, int n, struct result *r)
+{
+	struct avl_node *root = NULL;
+	struct avl_it it;
+	uint64_t start;
+	int i, found = 0;
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		AVL_INSERT(el, &root, &elems[i]);
+	r->ins += bench_ns(bench_since(start));
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		found += AVL_LOOKUP(el, &root, &elems[order[i]]) != NULL;
+	r->look += bench_ns(bench_since(start));
+	assert(found == n);
+
+	start = bench_now();
+	AVL_IT_INIT(el, &it, root, NULL, NULL, 0);
+	for (i = 0; AVL_IT_NEXT(el, &it) != NULL; i++)
+		;
+	r->scan += bench_ns(bench_since(start));
+	assert(i == n);
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		AVL_DELETE(el, &root, &elems[order[i]]);
+	r->del += bench_ns(bench_since(start));
+	assert(root == NULL);
+}
+
+static void
+run_iavl(struct iel *elems, const int *order, int n, struct result *r)
+{
+	struct iavl_tree t;
+	struct iel *e;
+	uint64_t start;
+	int i, found = 0;
+
+	IAVL_INIT(&t, elems, struct iel, link);
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		IAVL_INSERT(iel, &t, &elems[i]);
+	r->ins += bench_ns(bench_since(start));
+	iavl_check(&t);
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		found += IAVL_LOOKUP(iel, &t, &elems[order[i]]) != NULL;
+	r->look += bench_ns(bench_since(start));
+	assert(found == n);
+
+	start = bench_now();
+	for (i = 0, e = IAVL_FIRST(iel, &t); e != NULL; i++)
+		e = IAVL_NEXT(iel, &t, e);
+	r->scan += bench_ns(bench_since(start));
+	assert(i == n);
+
+	start = bench_now();
+	for (i = 0; i < n / 2; i++)
+		IAVL_DELETE(iel, &t, &elems[order[i]]);
+	r->del += bench_ns(bench_since(start));
+	iavl_check(&t);
+	start = bench_now();
+	for (; i < n; i++)
+		IAVL_DELETE(iel, &t, &elems[order[i]]);
+	r->del += bench_ns(bench_since(start));
+	assert(IAVL_EMPTY(&t));
+}
+
+static void
+print_result(const struct result *r, double nops)
+{
+	printf(" %f %f %f %f", r->ins / nops, r->look / nops,
+	    r->scan / nops, r->del / nops);
+}
+
+static void
+run_one(int n)
+{
+	struct result rf, rg, ri;
+	struct el *elems;
+	struct iel *ielems;
+	int *order;
+	int i, rep, reps;
+
+	if ((elems = calloc(n, sizeof(*elems))) == NULL)
+		err(1, "calloc");
+	if ((ielems = calloc(n, sizeof(*ielems))) == NULL)
+		err(1, "calloc");
+	if ((order = calloc(n, sizeof(*order))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < n; i++)
+		order[i] = i;
+
+	reps = n < 1000000 ? 1000000 / n : 1;
+	memset(&rf, 0, sizeof(rf));
+	memset(&rg, 0, sizeof(rg));
+	memset(&ri, 0, sizeof(ri));
+	for (rep = 0; rep < reps; rep++) {
+		for (i = 0; i < n; i++)
+			ielems[i].key = elems[i].key = bench_random();
+		shuffle(order, n);
+		run_fn(elems, order, n, &rf);
+		run_gen(elems, order, n, &rg);
+		run_iavl(ielems, order, n, &ri);
+	}
+
+	printf("%d", n);
+	print_result(&rf, (double)n * reps);
+	print_result(&rg, (double)n * reps);
+	print_result(&ri, (double)n * reps);
+	printf("\n");
+	fflush(stdout);
+
+	free(order);
+	free(ielems);
+	free(elems);
+}
+
+/* Check the balance and order of a tree, return the number of nodes. */
+static int
+check_count(struct avl_node *root)
+{
+	struct avl_it it;
+	int i;
+
+	if (root == NULL)
+		return 0;
+	avl_check(root, el_node_cmp);
+	avl_it_init(&it, root, NULL, NULL, el_node_cmp);
+	for (i = 0; avl_it_next(&it) != NULL; i++)
+		;
+	return i;
+}
+
+/*
+ * Sorted data. nelem inserts against avl_build_sorted, then the first
+ * half of the tree taken out with one delete each against one split.
+ * ns per element. The halves are checked and joined back together.
+ */
+static void
+build_one(int n)
+{
+	struct avl_node *root, **items, *lo, *hi;
+	struct el *elems;
+	uint64_t s, ti, tb, td, ts;
+	int i;
+
+	if ((elems = calloc(n, sizeof(*elems))) == NULL)
+		err(1, "calloc");
+	if ((items = calloc(n, sizeof(*items))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < n; i++) {
+		elems[i].key = i;
+		items[i] = &elems[i].link;
+	}
+
+	root = NULL;
+	s = bench_now();
+	for (i = 0; i < n; i++)
+		AVL_INSERT(el, &root, &elems[i]);
+	ti = bench_since(s);
+
+	s = bench_now();
+	for (i = 0; i < n / 2; i++)
+		AVL_DELETE(el, &root, &elems[i]);
+	td = bench_since(s);
+
+	s = bench_now();
+	root = avl_build_sorted(items, n);
+	tb = bench_since(s);
+	avl_check(root, el_node_cmp);
+
+	s = bench_now();
+	avl_split(&root, &elems[n / 2].link, el_node_cmp, &lo, &hi);
+	ts = bench_since(s);
+	assert(avl_lookup(&elems[n / 2].link, &hi, el_node_cmp) != NULL);
+	assert(avl_lookup(&elems[n / 2].link, &lo, el_node_cmp) == NULL);
+	assert(check_count(lo) == n / 2);
+	assert(check_count(hi) == n - n / 2);
+
+	avl_delete(&elems[n / 2].link, &hi, el_node_cmp);
+	root = avl_join(lo, &elems[n / 2].link, hi);
+	assert(check_count(root) == n);
+
+	printf("%d %f %f %f %f\n", n, bench_ns(ti) / n, bench_ns(tb) / n,
+	    bench_ns(td) / (n / 2), bench_ns(ts) / (n / 2));
+	fflush(stdout);
+	free(items);
+	free(elems);
+}
+
+/*
+ * Random inserts and deletes of keys with many duplicates, every now
+ * and then the whole tree is checked. With AVL_AUGMENT every node
+ * also keeps the sum of the keys below it through aug, we compare it
+ * against a sum done by hand, check that avl_select and avl_rank
+ * agree on every position and count random ranges the slow way. The
+ * tree is also split at random and joined back. The same operations
+ * go to an IAVL, checked with iavl_check and a walk in order.
+ */
+struct cel {
+	struct avl_node link;
+	struct iavl_node ilink;
+	int key;
+	int in;
+	long sum;
+};
+
+static int
+cel_cmp(const struct avl_node *an, const struct avl_node *bn)
+{
+	const struct cel *a = avl_data(an, struct cel, link);
+	const struct cel *b = avl_data(bn, struct cel, link);
+
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return (a > b) - (a < b);
+}
+
+static inline int
+cel_icmp(const struct cel *a, const struct cel *b)
+{
+	return cel_cmp(&a->link, &b->link);
+}
+
+IAVL_PROTOTYPE(cel, struct cel, ilink, cel_icmp, static)
+IAVL_GENERATE(cel, struct cel, ilink, cel_icmp, static)
+
+static void
+check_iavl(struct iavl_tree *it, int nin)
+{
+	struct cel *c, *prev = NULL;
+	int i = 0;
+
+	iavl_check(it);
+	for (c = IAVL_FIRST(cel, it); c != NULL; c = IAVL_NEXT(cel, it, c)) {
+		assert(c->in);
+		assert(prev == NULL || cel_icmp(prev, c) < 0);
+		prev = c;
+		i++;
+	}
+	assert(i == nin);
+}
+
+#ifdef AVL_AUGMENT
+static long
+cel_sum(struct avl_node *n)
+{
+	return n ? avl_data(n, struct cel, link)->sum : 0;
+}
+
+static void
+cel_aug(struct avl_node *n)
+{
+	struct cel *c = avl_data(n, struct cel, link);
+
+	c->sum = c->key + cel_sum(n->link[0]) + cel_sum(n->link[1]);
+}
+
+/* The sum the slow way, and check it on the way. */
+static long
+cel_check_sum(struct avl_node *n)
+{
+	long sum;
+
+	if (n == NULL)
+		return 0;
+	sum = avl_data(n, struct cel, link)->key +
+	    cel_check_sum(n->link[0]) + cel_check_sum(n->link[1]);
+	assert(cel_sum(n) == sum);
+	return sum;
+}
+
+static void
+cel_check_aug(struct avl_tree *t, struct cel *elems, int n, int nin)
+{
+	struct cel *s, *e, *c;
+	int i, k, cnt;
+
+	cel_check_sum(t->root);
+	assert(avl_size(t->root) == nin);
+	for (k = 0; k < nin; k++)
+		assert(avl_rank(avl_select(&t->root, k), &t->root, cel_cmp) == k);
+	assert(avl_select(&t->root, nin) == NULL);
+
+	for (k = 0; k < 10; k++) {
+		s = &elems[bench_random_uniform(n)];
+		e = &elems[bench_random_uniform(n)];
+		if (cel_cmp(&s->link, &e->link) > 0) {
+			c = s;
+			s = e;
+			e = c;
+		}
+		for (cnt = i = 0; i < n; i++)
+			cnt += elems[i].in &&
+			    cel_cmp(&elems[i].link, &s->link) >= 0 &&
+			    cel_cmp(&elems[i].link, &e->link) < 0;
+		assert(avl_count(&s->link, &e->link, &t->root, cel_cmp) == cnt);
+	}
+}
+#endif
+
+static void
+check_half(struct avl_tree *t)
+{
+	avl_tree_check(t, cel_cmp);
+#ifdef AVL_AUGMENT
+	cel_check_sum(t->root);
+#endif
+}
+
+/*
+ * Split at x and put the halves back together around the first node
+ * of the upper half.
+ */
+static void
+check_split_join(struct avl_tree *t, struct cel *x)
+{
+	struct avl_tree lo = AVL_TREE_INITIALIZER;
+	struct avl_node *m;
+
+	avl_tree_split(t, &x->link, cel_cmp, &lo);
+	check_half(&lo);
+	check_half(t);
+	if ((m = avl_tree_min(t)) != NULL) {
+		assert(cel_cmp(m, &x->link) >= 0);
+		avl_tree_delete(t, m, cel_cmp);
+		avl_tree_join(&lo, m, t);
+		assert(t->root == NULL && t->min == NULL);
+	}
+	*t = lo;
+}
+
+static void
+check_one(int n)
+{
+	struct avl_tree t = AVL_TREE_INITIALIZER;
+	struct iavl_tree it;
+	struct cel *elems, *c;
+	int i, op, nin = 0;
+
+	if ((elems = calloc(n, sizeof(*elems))) == NULL)
+		err(1, "calloc");
+	IAVL_INIT(&it, elems, struct cel, ilink);
+	for (i = 0; i < n; i++)
+		elems[i].key = bench_random_uniform(n / 4 + 1);
+#ifdef AVL_AUGMENT
+	t.aug = cel_aug;
+#endif
+
+	for (op = 1; op <= 10 * n; op++) {
+		c = &elems[bench_random_uniform(n)];
+		if (c->in) {
+			avl_tree_delete(&t, &c->link, cel_cmp);
+			IAVL_DELETE(cel, &it, c);
+			nin--;
+		} else {
+			avl_tree_insert(&t, &c->link, cel_cmp);
+			IAVL_INSERT(cel, &it, c);
+			nin++;
+		}
+		c->in = !c->in;
+		if (op % n == 0) {
+			avl_tree_check(&t, cel_cmp);
+#ifdef AVL_AUGMENT
+			cel_check_aug(&t, elems, n, nin);
+#endif
+			check_iavl(&it, nin);
+			check_split_join(&t, &elems[bench_random_uniform(n)]);
+			avl_tree_check(&t, cel_cmp);
+#ifdef AVL_AUGMENT
+			cel_check_aug(&t, elems, n, nin);
+#endif
+		}
+	}
+
+	printf("%d %d %d\n", n, 10 * n, t.root ? t.root->height : 0);
+	fflush(stdout);
+	free(elems);
+}
+
+#ifndef nitems
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+#endif
+int tests[] = {
+	100, 1000, 10000, 100000, 1000000
+};
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: avl_test [-bc] [-s seed] [-T timer] [nelem]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	void (*one)(int) = run_one;
+	const char *timer = "clock";
+	int ch, i;
+
+	while ((ch = getopt(argc, argv, "bcs:T:")) != -1) {
+		switch (ch) {
+		case 'b':
+			one = build_one;
+			break;
+		case 'c':
+			one = check_one;
+			break;
+		case 's':
+			bench_seed(strtoull(optarg, NULL, 0));
+			break;
+		case 'T':
+			timer = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (bench_timer_init(timer) == -1)
+		errx(1, "timer %s not available", timer);
+
+	if (one == run_one)
+		printf("# nelem, then insert lookup scan delete of avl_comp_fn AVL_GENERATE IAVL\n");
+	else if (one == check_one)
+		printf("# nelem, random inserts and deletes checked, height\n");
+	else
+		printf("# nelem, insert build, then delete split of half\n");
+	if (argc == 1) {
+		one(atoi(argv[0]));
+		return 0;
+	}
+	for (i = 0; i < nitems(tests); i++)
+		one(tests[i]);
+
+	return 0;
+}
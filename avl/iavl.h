@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef __IAVL_H__
+#define __IAVL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "avl.h"
+
+/*
+ * IAVL is the avl for elements that all live in one array, like IHEAP.
+ * A node is two 32 bit indices, 8 bytes instead of 24. There is no
+ * height, the top bit of link[d] is set when the d side of the node
+ * is one taller than the other, insert and delete keep those two bits
+ * right without ever knowing how tall anything is.
+ *
+ * Index 0 is NULL, element i of the array is index i + 1, so a tree
+ * holds at most 2^31 - 1 elements. The array is given to IAVL_INIT
+ * and can't move while the tree is in use, an arena is a good place
+ * for it.
+ *
+ *	IAVL_PROTOTYPE(name, type, field, cmp, funprefix)
+ *	IAVL_GENERATE(name, type, field, cmp, funprefix)
+ *
+ * NEXT walks from the root every time, there is nothing in the node
+ * to get back up with.
+ */
+struct iavl_node {
+	uint32_t link[2];
+};
+
+struct iavl_tree {
+	char *base;
+	size_t size;		/* of an element */
+	size_t off;		/* of the iavl_node in the element */
+	uint32_t root;
+};
+
+#define IAVL_HEAVY 0x80000000U
+#define IAVL_IDX(l) ((l) & ~IAVL_HEAVY)
+
+#define IAVL_INIT(t, b, type, field) do {				\
+	(t)->base = (char *)(b);					\
+	(t)->size = sizeof(type);					\
+	(t)->off = offsetof(type, field);				\
+	(t)->root = 0;							\
+} while (0)
+#define IAVL_EMPTY(t) ((t)->root == 0)
+#define IAVL_EL(t, type, i) (&((type *)(t)->base)[(i) - 1])
+#define IAVL_ELIDX(t, el) ((uint32_t)((el) - (__typeof__(el))(t)->base) + 1)
+
+#define IAVL_INSERT(name, t, el) name##_IAVL_INSERT(t, el)
+#define IAVL_DELETE(name, t, el) name##_IAVL_DELETE(t, el)
+#define IAVL_LOOKUP(name, t, el) name##_IAVL_LOOKUP(t, el)
+#define IAVL_SEARCH(name, t, el) name##_IAVL_SEARCH(t, el)
+#define IAVL_FIRST(name, t) name##_IAVL_NEXT(t, NULL)
+#define IAVL_NEXT(name, t, el) name##_IAVL_NEXT(t, el)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int iavl_check(struct iavl_tree *);
+
+/* For IAVL_GENERATE. */
+void iavl_link_internal(struct iavl_tree *, uint32_t, uint32_t **, int);
+void iavl_unlink_internal(struct iavl_tree *, uint32_t **, int);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * The path given to the internal functions is every link on the way
+ * down, the last one is where the element goes or where it is.
+ */
+#define IAVL_PROTOTYPE(name, type, field, cmp, funprefix)		\
+funprefix void name##_IAVL_INSERT(struct iavl_tree *, type *);		\
+funprefix void name##_IAVL_DELETE(struct iavl_tree *, type *);		\
+funprefix type *name##_IAVL_LOOKUP(struct iavl_tree *, const type *);	\
+funprefix type *name##_IAVL_SEARCH(struct iavl_tree *, const type *);	\
+funprefix type *name##_IAVL_NEXT(struct iavl_tree *, const type *);
+
+#define IAVL_GENERATE(name, type, field, cmp, funprefix)		\
+AVL_UNUSED funprefix void						\
+name##_IAVL_INSERT(struct iavl_tree *t, type *el)			\
+{									\
+	uint32_t *path[AVL_MAXDEPTH], *p = &t->root, i;			\
+	int depth = 0;							\
+									\
+	while ((i = IAVL_IDX(*p)) != 0) {				\
+		path[depth++] = p;					\
+		p = &IAVL_EL(t, type, i)->field.link[			\
+		    cmp(el, IAVL_EL(t, type, i)) > 0];			\
+	}								\
+	path[depth++] = p;						\
+	iavl_link_internal(t, IAVL_ELIDX(t, el), path, depth);		\
+}									\
+									\
+AVL_UNUSED funprefix void						\
+name##_IAVL_DELETE(struct iavl_tree *t, type *el)			\
+{									\
+	uint32_t *path[AVL_MAXDEPTH], *p = &t->root, i;			\
+	uint32_t x = IAVL_ELIDX(t, el);					\
+	int depth = 0;							\
+									\
+	while ((i = IAVL_IDX(*p)) != x) {				\
+		if (i == 0)						\
+			return;						\
+		path[depth++] = p;					\
+		p = &IAVL_EL(t, type, i)->field.link[			\
+		    cmp(el, IAVL_EL(t, type, i)) > 0];			\
+	}								\
+	path[depth++] = p;						\
+	iavl_unlink_internal(t, path, depth);				\
+}									\
+									\
+AVL_UNUSED funprefix type *						\
+name##_IAVL_LOOKUP(struct iavl_tree *t, const type *el)			\
+{									\
+	uint32_t i = t->root;						\
+	int d;								\
+									\
+	while (i != 0) {						\
+		if ((d = cmp(el, IAVL_EL(t, type, i))) == 0)		\
+			return IAVL_EL(t, type, i);			\
+		i = IAVL_IDX(IAVL_EL(t, type, i)->field.link[d > 0]);	\
+	}								\
+	return NULL;							\
+}									\
+									\
+/*									\
+ * Return the best greater or equal match.				\
+ */									\
+AVL_UNUSED funprefix type *						\
+name##_IAVL_SEARCH(struct iavl_tree *t, const type *el)			\
+{									\
+	uint32_t i = t->root, best = 0;					\
+	int d;								\
+									\
+	while (i != 0) {						\
+		if ((d = cmp(el, IAVL_EL(t, type, i))) == 0)		\
+			return IAVL_EL(t, type, i);			\
+		if (d < 0)						\
+			best = i;					\
+		i = IAVL_IDX(IAVL_EL(t, type, i)->field.link[d > 0]);	\
+	}								\
+	return best ? IAVL_EL(t, type, best) : NULL;			\
+}									\
+									\
+/*									\
+ * The first element after el, or the first of all for NULL.		\
+ */									\
+AVL_UNUSED funprefix type *						\
+name##_IAVL_NEXT(struct iavl_tree *t, const type *el)			\
+{									\
+	uint32_t i = t->root, best = 0;					\
+	int d;								\
+									\
+	while (i != 0) {						\
+		if ((d = (el == NULL ? -1 :				\
+		    cmp(el, IAVL_EL(t, type, i)))) < 0)			\
+			best = i;					\
+		i = IAVL_IDX(IAVL_EL(t, type, i)->field.link[d >= 0]);	\
+	}								\
+	return best ? IAVL_EL(t, type, best) : NULL;			\
+}
+
+#endif
@@ -23,35 +23,58 @@
 #undef max
 #define max(a, b) (a > b ? a : b)
 
+#ifdef AVL_AUGMENT
+#define AVL_AUGMENTED 1
+#define avl_tree_aug(t) ((t) != NULL ? (t)->aug : NULL)
+#else
+#define AVL_AUGMENTED 0
+#define avl_tree_aug(t) NULL
+#endif
+
+/*
+ * Where a node is hung into the tree. Readers of avl_rcu walk the tree
+ * while we change it, the node must be all there before they can see
+ * it. A plain store on x86, it only keeps the compiler in order.
+ * Links in nodes that readers can already be at are changed with
+ * avl_relink, the reader sees the old or the new pointer and never
+ * anything the compiler made up in between.
+ */
+#define avl_publish(p, n) __atomic_store_n((p), (n), __ATOMIC_RELEASE)
+#define avl_relink(p, n) __atomic_store_n((p), (n), __ATOMIC_RELAXED)
+
 /* these macros make performance quite a bit better */
-#define avl_height(n) (n ? n->height : 0)
-#define avl_reheight(n) do { (n)->height = max(avl_height((n)->link[0]), avl_height((n)->link[1])) + 1; } while (0)
+#define avl_height(n) ((n) ? (n)->height : 0)
+#ifdef AVL_AUGMENT
+#define avl_reheight(n, aug) do { (n)->height = max(avl_height((n)->link[0]), avl_height((n)->link[1])) + 1; (n)->size = avl_size((n)->link[0]) + avl_size((n)->link[1]) + 1; if (aug) aug(n); } while (0)
+#else
+#define avl_reheight(n, aug) do { (n)->height = max(avl_height((n)->link[0]), avl_height((n)->link[1])) + 1; } while (0)
+#endif
 #define avl_balance(n) (n ? avl_height(n->link[0]) - avl_height(n->link[1]) : 0)
 
 struct avl_node *avl_search_internal(const struct avl_node *, struct avl_node *, avl_comp_fn);
 
 static void
-avl_rotate(struct avl_node **p, int d)
+avl_rotate(struct avl_node **p, int d, avl_aug_fn aug)
 {
 	struct avl_node *pivot;
 	struct avl_node *n = *p;
 
 	pivot = n->link[!d];
-	n->link[!d] = pivot->link[d];
-	pivot->link[d] = n;
-	avl_reheight(n);
-	avl_reheight(pivot);
-	*p = pivot;
+	avl_relink(&n->link[!d], pivot->link[d]);
+	avl_relink(&pivot->link[d], n);
+	avl_reheight(n, aug);
+	avl_reheight(pivot, aug);
+	avl_publish(p, pivot);
 }
 
 static void
-avl_rebalance(struct avl_node **p)
+avl_rebalance(struct avl_node **p, avl_aug_fn aug)
 {
 	struct avl_node *n = *p;
 	int bal;
 	int d;
 
-	avl_reheight(n);
+	avl_reheight(n, aug);
 	bal = avl_balance(n);
 
 	if (bal >= -1 && bal <= 1)
@@ -60,61 +83,368 @@ avl_rebalance(struct avl_node **p)
 	d = bal < -1;
 
 	if ((d ? 1 : -1) * (avl_balance(n->link[d])) >= 0)
-		avl_rotate(&n->link[d], d);
+		avl_rotate(&n->link[d], d, aug);
 
-	avl_rotate(p, !d);
+	avl_rotate(p, !d, aug);
 }
 
+/*
+ * Insert and delete remember the way down and rebalance on the way
+ * back up. Once a subtree has the same height as before nothing above
+ * it can change and we stop. Except the sizes and aggregates, with
+ * AVL_AUGMENT we go all the way.
+ */
+static void
+avl_fixup(struct avl_node ***path, int depth, avl_aug_fn aug)
+{
+	struct avl_node **p;
+	int h;
+
+	while (depth-- > 0) {
+		p = path[depth];
+		h = (*p)->height;
+		avl_rebalance(p, aug);
+		if (!AVL_AUGMENTED && (*p)->height == h)
+			break;
+	}
+}
+
+/*
+ * Put x at *p, found on the way down path. nb are the nodes before and
+ * after x in order, the last node we went right from and the last one
+ * we went left from.
+ */
 void
-avl_insert(struct avl_node *x, struct avl_node **p, avl_comp_fn cmp)
+avl_link_internal(struct avl_tree *t, struct avl_node *x, struct avl_node **p,
+    struct avl_node ***path, int depth, struct avl_node **nb)
+{
+	x->link[0] = x->link[1] = NULL;
+	x->height = 1;
+#ifdef AVL_AUGMENT
+	x->size = 1;
+	if (avl_tree_aug(t) != NULL)
+		t->aug(x);
+#endif
+	avl_publish(p, x);
+#ifdef AVL_THREADED
+	x->thr[0] = nb[0];
+	x->thr[1] = nb[1];
+	if (nb[0] != NULL)
+		nb[0]->thr[1] = x;
+	if (nb[1] != NULL)
+		nb[1]->thr[0] = x;
+#endif
+	if (t != NULL && nb[0] == NULL)
+		t->min = x;
+	avl_fixup(path, depth, avl_tree_aug(t));
+}
+
+/*
+ * Take x out, it's at *p at the end of path.
+ */
+void
+avl_unlink_internal(struct avl_tree *t, struct avl_node *x, struct avl_node **p,
+    struct avl_node ***path, int depth)
 {
+	struct avl_node **q, *r, *n = x;
+	int at;
+
+	/*
+	 * The smallest node has no left child. What comes after it is
+	 * the leftmost node on the right or its parent.
+	 */
+	if (t != NULL && t->min == x) {
+#ifdef AVL_THREADED
+		t->min = x->thr[1];
+#else
+		if ((r = x->link[1]) != NULL) {
+			while (r->link[0] != NULL)
+				r = r->link[0];
+			t->min = r;
+		} else {
+			t->min = depth ? *path[depth - 1] : NULL;
+		}
+#endif
+	}
+#ifdef AVL_THREADED
+	if (x->thr[0] != NULL)
+		x->thr[0]->thr[1] = x->thr[1];
+	if (x->thr[1] != NULL)
+		x->thr[1]->thr[0] = x->thr[0];
+#endif
+
+	if (n->link[0] == NULL) {
+		avl_publish(p, n->link[1]);
+	} else if (n->link[1] == NULL) {
+		avl_publish(p, n->link[0]);
+	} else {
+		/*
+		 * One would think that choosing the taller or shorter side would
+		 * make a difference. It doesn't, so just arbitrarily choose the
+		 * left side.
+		 */
+		at = depth;
+		path[depth++] = p;
+		q = &n->link[0];
+		while ((*q)->link[1] != NULL) {
+			path[depth++] = q;
+			q = &(*q)->link[1];
+		}
+		r = *q;
+		avl_relink(q, r->link[0]);
+		avl_relink(&r->link[0], n->link[0]);
+		avl_relink(&r->link[1], n->link[1]);
+		r->height = n->height;
+		avl_publish(p, r);
+		/* The way down went through n, now it goes through r. */
+		if (depth > at + 1)
+			path[at + 1] = &r->link[0];
+	}
+	avl_fixup(path, depth, avl_tree_aug(t));
+}
+
+static void
+avl_do_insert(struct avl_tree *t, struct avl_node *x, struct avl_node **p,
+    avl_comp_fn cmp)
+{
+	struct avl_node **path[AVL_MAXDEPTH];
+	struct avl_node *n, *nb[2] = { NULL, NULL };
+	int depth = 0, d;
+
+	while ((n = *p) != NULL) {
+		path[depth++] = p;
+		d = cmp(x, n) > 0;
+		nb[!d] = n;
+		p = &n->link[d];
+	}
+	avl_link_internal(t, x, p, path, depth, nb);
+}
+
+static void
+avl_do_delete(struct avl_tree *t, struct avl_node *x, struct avl_node **p,
+    avl_comp_fn cmp)
+{
+	struct avl_node **path[AVL_MAXDEPTH];
 	struct avl_node *n;
+	int depth = 0;
 
-	if ((n = *p) == NULL) {
-		x->link[0] = x->link[1] = NULL;
-		x->height = 1;
-		*p = x;
-		return;
+	while ((n = *p) != x) {
+		if (n == NULL)
+			return;
+		path[depth++] = p;
+		p = &n->link[cmp(x, n) > 0];
 	}
-	avl_insert(x, &n->link[cmp(x, n) > 0], cmp);
-	avl_rebalance(p);
+	avl_unlink_internal(t, x, p, path, depth);
+}
+
+void
+avl_insert(struct avl_node *x, struct avl_node **p, avl_comp_fn cmp)
+{
+	avl_do_insert(NULL, x, p, cmp);
 }
 
 void
 avl_delete(struct avl_node *x, struct avl_node **p, avl_comp_fn cmp)
 {
-	struct avl_node *n = *p;
+	avl_do_delete(NULL, x, p, cmp);
+}
 
-	if (n == NULL)
-		return;
+void
+avl_tree_insert(struct avl_tree *t, struct avl_node *x, avl_comp_fn cmp)
+{
+	avl_do_insert(t, x, &t->root, cmp);
+}
 
-	if (x == n) {
-		if (n->link[0] == NULL) {
-			*p = n->link[1];
-		} else if (n->link[1] == NULL) {
-			*p = n->link[0];
-		} else {
-			/*
-			 * One would think that choosing the taller or shorter side would
-			 * make a difference. It doesn't, so just arbitrarily choose the
-			 * left side.
-			 */
-			struct avl_node *r = n->link[0];
-
-			while (r->link[1] != NULL)
-				r = r->link[1];
-			avl_delete(r, &n->link[0], cmp);
-			r->link[0] = n->link[0];
-			r->link[1] = n->link[1];
-			avl_reheight(r);
-			*p = r;
-		}
+void
+avl_tree_delete(struct avl_tree *t, struct avl_node *x, avl_comp_fn cmp)
+{
+	avl_do_delete(t, x, &t->root, cmp);
+}
+
+/*
+ * Build a perfectly balanced tree out of n nodes that are in order.
+ */
+static struct avl_node *
+avl_build(struct avl_node **nodes, int n, avl_aug_fn aug)
+{
+	struct avl_node *x;
+
+	if (n == 0)
+		return NULL;
+	x = nodes[n / 2];
+	x->link[0] = avl_build(nodes, n / 2, aug);
+	x->link[1] = avl_build(nodes + n / 2 + 1, n - n / 2 - 1, aug);
+	avl_reheight(x, aug);
+	return x;
+}
+
+static void
+avl_thread(struct avl_node **nodes, int n)
+{
+#ifdef AVL_THREADED
+	int i;
+
+	for (i = 0; i < n; i++) {
+		nodes[i]->thr[0] = i > 0 ? nodes[i - 1] : NULL;
+		nodes[i]->thr[1] = i < n - 1 ? nodes[i + 1] : NULL;
+	}
+#endif
+}
+
+struct avl_node *
+avl_build_sorted(struct avl_node **nodes, int n)
+{
+	avl_thread(nodes, n);
+	return avl_build(nodes, n, NULL);
+}
+
+void
+avl_tree_build_sorted(struct avl_tree *t, struct avl_node **nodes, int n)
+{
+	avl_thread(nodes, n);
+	t->root = avl_build(nodes, n, avl_tree_aug(t));
+	t->min = n ? nodes[0] : NULL;
+}
+
+static struct avl_node *
+avl_end(struct avl_node *n, int d)
+{
+	if (n != NULL)
+		while (n->link[d] != NULL)
+			n = n->link[d];
+	return n;
+}
+
+/*
+ * Everything in l is before m and everything in r after. Walk down
+ * the side of the taller tree that faces m until a subtree is about
+ * as tall as the other tree, put m there with the other tree next to
+ * it and rebalance the way back up. That's the difference in height.
+ */
+static struct avl_node *
+avl_join_internal(struct avl_node *l, struct avl_node *m, struct avl_node *r,
+    avl_aug_fn aug)
+{
+	struct avl_node **path[AVL_MAXDEPTH];
+	struct avl_node **p, *root;
+	int depth = 0, d, h;
+
+	d = avl_height(l) < avl_height(r);
+	root = d ? r : l;
+	h = avl_height(d ? l : r);
+	p = &root;
+	while (avl_height(*p) > h + 1) {
+		path[depth++] = p;
+		p = &(*p)->link[!d];
+	}
+	m->link[d] = *p;
+	m->link[!d] = d ? l : r;
+	avl_reheight(m, aug);
+	avl_publish(p, m);
+	avl_fixup(path, depth, aug);
+	return root;
+}
+
+static void
+avl_thread_join(struct avl_node *l, struct avl_node *m, struct avl_node *r)
+{
+#ifdef AVL_THREADED
+	struct avl_node *n;
+
+	if ((m->thr[0] = n = avl_end(l, 1)) != NULL)
+		n->thr[1] = m;
+	if ((m->thr[1] = n = avl_end(r, 0)) != NULL)
+		n->thr[0] = m;
+#endif
+}
+
+struct avl_node *
+avl_join(struct avl_node *l, struct avl_node *m, struct avl_node *r)
+{
+	avl_thread_join(l, m, r);
+	return avl_join_internal(l, m, r, NULL);
+}
+
+/*
+ * Put m and then everything in hi after the nodes of t, hi is left
+ * empty.
+ */
+void
+avl_tree_join(struct avl_tree *t, struct avl_node *m, struct avl_tree *hi)
+{
+	avl_thread_join(t->root, m, hi->root);
+	t->root = avl_join_internal(t->root, m, hi->root, avl_tree_aug(t));
+	if (t->min == NULL)
+		t->min = m;
+	hi->root = hi->min = NULL;
+}
+
+/*
+ * Every node on the way down to where x would be is joined with the
+ * side of it that isn't on the way, the joins get more expensive the
+ * taller the trees get but it adds up to the height of the tree.
+ */
+static void
+avl_split_internal(struct avl_node *n, const struct avl_node *x,
+    avl_comp_fn cmp, struct avl_node **l, struct avl_node **r, avl_aug_fn aug)
+{
+	struct avl_node *t;
+
+	if (n == NULL) {
+		*l = *r = NULL;
+		return;
+	}
+	if (cmp(x, n) <= 0) {
+		avl_split_internal(n->link[0], x, cmp, l, &t, aug);
+		*r = avl_join_internal(t, n, n->link[1], aug);
 	} else {
-		avl_delete(x, &n->link[cmp(x, n) > 0], cmp);
-		avl_rebalance(p);
+		avl_split_internal(n->link[1], x, cmp, &t, r, aug);
+		*l = avl_join_internal(n->link[0], n, t, aug);
 	}
 }
 
+static void
+avl_unthread(struct avl_node *l, struct avl_node *r)
+{
+#ifdef AVL_THREADED
+	if ((l = avl_end(l, 1)) != NULL)
+		l->thr[1] = NULL;
+	if ((r = avl_end(r, 0)) != NULL)
+		r->thr[0] = NULL;
+#endif
+}
+
+/*
+ * Split the tree in the nodes below x, in *l, and the rest, in *r.
+ */
+void
+avl_split(struct avl_node **root, const struct avl_node *x, avl_comp_fn cmp,
+    struct avl_node **l, struct avl_node **r)
+{
+	avl_split_internal(*root, x, cmp, l, r, NULL);
+	avl_unthread(*l, *r);
+	*root = NULL;
+}
+
+/*
+ * Move the nodes below x from t to lo, which was empty.
+ */
+void
+avl_tree_split(struct avl_tree *t, const struct avl_node *x, avl_comp_fn cmp,
+    struct avl_tree *lo)
+{
+	struct avl_node *r;
+
+	avl_split_internal(t->root, x, cmp, &lo->root, &r, avl_tree_aug(t));
+	avl_unthread(lo->root, r);
+	lo->min = lo->root != NULL ? t->min : NULL;
+	t->root = r;
+	t->min = avl_end(r, 0);
+#ifdef AVL_AUGMENT
+	lo->aug = t->aug;
+#endif
+}
+
 struct avl_node *
 avl_lookup(const struct avl_node *x, struct avl_node **root, avl_comp_fn cmp)
 {
@@ -170,6 +500,9 @@ avl_check(struct avl_node *n, avl_comp_fn cmp)
 	if (n->link[0] == NULL && n->link[1] == NULL)
 		assert(avl_height(n) == 1);
 	assert(avl_height(n) == max(avl_height(n->link[0]), avl_height(n->link[1])) + 1);
+#ifdef AVL_AUGMENT
+	assert(n->size == avl_size(n->link[0]) + avl_size(n->link[1]) + 1);
+#endif
 
 	if (n->link[0]) {
 		assert(cmp(n, n->link[0]) >= 0);
@@ -181,6 +514,82 @@ avl_check(struct avl_node *n, avl_comp_fn cmp)
 	}
 }
 
+#ifdef AVL_AUGMENT
+/*
+ * The number of nodes below x.
+ */
+int
+avl_rank(const struct avl_node *x, struct avl_node **root, avl_comp_fn cmp)
+{
+	struct avl_node *n = *root;
+	int rank = 0;
+
+	while (n != NULL) {
+		if (cmp(x, n) > 0) {
+			rank += avl_size(n->link[0]) + 1;
+			n = n->link[1];
+		} else {
+			n = n->link[0];
+		}
+	}
+	return rank;
+}
+
+/*
+ * The k:th smallest node, counting from 0.
+ */
+struct avl_node *
+avl_select(struct avl_node **root, int k)
+{
+	struct avl_node *n = *root;
+	int l;
+
+	while (n != NULL) {
+		if (k < (l = avl_size(n->link[0]))) {
+			n = n->link[0];
+		} else if (k == l) {
+			return n;
+		} else {
+			k -= l + 1;
+			n = n->link[1];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * The number of nodes not below s and below e.
+ */
+int
+avl_count(const struct avl_node *s, const struct avl_node *e,
+    struct avl_node **root, avl_comp_fn cmp)
+{
+	return avl_rank(e, root, cmp) - avl_rank(s, root, cmp);
+}
+#endif
+
+void
+avl_tree_check(struct avl_tree *t, avl_comp_fn cmp)
+{
+	struct avl_node *n;
+
+	if ((n = t->root) == NULL) {
+		assert(t->min == NULL);
+		return;
+	}
+	avl_check(n, cmp);
+	while (n->link[0] != NULL)
+		n = n->link[0];
+	assert(t->min == n);
+#ifdef AVL_THREADED
+	assert(n->thr[0] == NULL);
+	for (; n->thr[1] != NULL; n = n->thr[1]) {
+		assert(n->thr[1]->thr[0] == n);
+		assert(cmp(n, n->thr[1]) <= 0);
+	}
+#endif
+}
+
 void
 avl_it_init(struct avl_it *it, struct avl_node *root, struct avl_node *s,
     struct avl_node *e, avl_comp_fn cmp)
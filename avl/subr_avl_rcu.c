@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <sched.h>
+#include <string.h>
+
+#include "avl_rcu.h"
+
+#define avl_load(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+void
+avl_rcu_init(struct avl_rcu *r)
+{
+	memset(r, 0, sizeof(*r));
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_mutex_init(&r->rlock, NULL);
+	r->epoch = 1;
+}
+
+void
+avl_rcu_destroy(struct avl_rcu *r)
+{
+	pthread_mutex_destroy(&r->lock);
+	pthread_mutex_destroy(&r->rlock);
+}
+
+void
+avl_rcu_register(struct avl_rcu *r, struct avl_rcu_reader *rd)
+{
+	rd->epoch = 0;
+	pthread_mutex_lock(&r->rlock);
+	rd->next = r->readers;
+	r->readers = rd;
+	pthread_mutex_unlock(&r->rlock);
+}
+
+void
+avl_rcu_unregister(struct avl_rcu *r, struct avl_rcu_reader *rd)
+{
+	struct avl_rcu_reader **p;
+
+	pthread_mutex_lock(&r->rlock);
+	for (p = &r->readers; *p != NULL; p = &(*p)->next) {
+		if (*p == rd) {
+			*p = rd->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&r->rlock);
+}
+
+/*
+ * The sequence number is odd while a writer is in the tree.
+ */
+static inline void
+avl_rcu_write_begin(struct avl_rcu *r)
+{
+	pthread_mutex_lock(&r->lock);
+	__atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+avl_rcu_write_end(struct avl_rcu *r)
+{
+	__atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static inline unsigned long
+avl_rcu_read_begin(struct avl_rcu *r)
+{
+	return __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Did the tree change since avl_rcu_read_begin returned s?
+ */
+static inline int
+avl_rcu_read_retry(struct avl_rcu *r, unsigned long s)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (s & 1) || __atomic_load_n(&r->seq, __ATOMIC_RELAXED) != s;
+}
+
+void
+avl_rcu_insert(struct avl_rcu *r, struct avl_node *x, avl_comp_fn cmp)
+{
+	avl_rcu_write_begin(r);
+	avl_tree_insert(&r->tree, x, cmp);
+	avl_rcu_write_end(r);
+}
+
+void
+avl_rcu_delete(struct avl_rcu *r, struct avl_node *x, avl_comp_fn cmp)
+{
+	avl_rcu_write_begin(r);
+	avl_tree_delete(&r->tree, x, cmp);
+	avl_rcu_write_end(r);
+}
+
+/*
+ * Wait until every reader that was inside when we were called has
+ * left. Call it without being in a reader section, or it waits for
+ * itself.
+ */
+void
+avl_rcu_synchronize(struct avl_rcu *r)
+{
+	struct avl_rcu_reader *rd;
+	unsigned long e, re;
+
+	e = __atomic_add_fetch(&r->epoch, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&r->rlock);
+	for (rd = r->readers; rd != NULL; rd = rd->next)
+		while ((re = __atomic_load_n(&rd->epoch, __ATOMIC_ACQUIRE)) != 0 && re < e)
+			sched_yield();
+	pthread_mutex_unlock(&r->rlock);
+}
+
+/*
+ * A walk through a tree that changes under us can take a wrong turn
+ * and go on for longer than the tree is deep, then we give up and
+ * walk again.
+ */
+struct avl_node *
+avl_rcu_lookup(struct avl_rcu *r, const struct avl_node *x, avl_comp_fn cmp)
+{
+	struct avl_node *n;
+	unsigned long s;
+	int d, depth;
+
+	do {
+		s = avl_rcu_read_begin(r);
+		n = avl_load(r->tree.root);
+		for (depth = 0; n != NULL && depth < AVL_MAXDEPTH; depth++) {
+			if ((d = cmp(x, n)) == 0)
+				return n;
+			n = avl_load(n->link[d > 0]);
+		}
+	} while (avl_rcu_read_retry(r, s));
+	return NULL;
+}
+
+/*
+ * Return the best greater or equal match.
+ */
+struct avl_node *
+avl_rcu_search(struct avl_rcu *r, const struct avl_node *x, avl_comp_fn cmp)
+{
+	struct avl_node *n, *best;
+	unsigned long s;
+	int d, depth;
+
+	do {
+		s = avl_rcu_read_begin(r);
+		n = avl_load(r->tree.root);
+		best = NULL;
+		for (depth = 0; n != NULL && depth < AVL_MAXDEPTH; depth++) {
+			if ((d = cmp(x, n)) == 0) {
+				best = n;
+				break;
+			}
+			if (d < 0)
+				best = n;
+			n = avl_load(n->link[d > 0]);
+		}
+	} while (avl_rcu_read_retry(r, s));
+	return best;
+}
+
+/*
+ * The node after x, x doesn't have to be in the tree anymore. This is
+ * the iterator, a walk from the root every time, there is no stack
+ * that a writer can make stale.
+ */
+struct avl_node *
+avl_rcu_next(struct avl_rcu *r, const struct avl_node *x, avl_comp_fn cmp)
+{
+	struct avl_node *n, *best;
+	unsigned long s;
+	int d, depth;
+
+	do {
+		s = avl_rcu_read_begin(r);
+		n = avl_load(r->tree.root);
+		best = NULL;
+		for (depth = 0; n != NULL && depth < AVL_MAXDEPTH; depth++) {
+			if ((d = (x == NULL ? -1 : cmp(x, n))) < 0)
+				best = n;
+			n = avl_load(n->link[d >= 0]);
+		}
+	} while (avl_rcu_read_retry(r, s));
+	return best;
+}
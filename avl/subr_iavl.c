@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <assert.h>
+
+#include "iavl.h"
+
+#define iavl_node(t, i) ((struct iavl_node *)((t)->base + ((i) - 1) * (t)->size + (t)->off))
+#define iavl_heavy(n, d) ((n)->link[d] & IAVL_HEAVY)
+
+/* Change where a link points, the balance bit stays. */
+static inline void
+iavl_set(uint32_t *p, uint32_t i)
+{
+	*p = (*p & IAVL_HEAVY) | i;
+}
+
+/*
+ * The node at *p is two taller on the d side. Returns 1 if the
+ * subtree ends up one lower than its taller side was before, which is
+ * always the case after an insert. Only a delete can leave the child
+ * balanced, then the rotation doesn't make the subtree any lower.
+ */
+static int
+iavl_rotate(struct iavl_tree *t, uint32_t *p, int d)
+{
+	uint32_t ai = IAVL_IDX(*p), ci, gi;
+	struct iavl_node *a, *c, *g;
+	int lower;
+
+	a = iavl_node(t, ai);
+	ci = IAVL_IDX(a->link[d]);
+	c = iavl_node(t, ci);
+
+	if (!iavl_heavy(c, !d)) {
+		lower = iavl_heavy(c, d) != 0;
+		a->link[d] = IAVL_IDX(c->link[!d]) | (lower ? 0 : IAVL_HEAVY);
+		c->link[!d] = ai | (lower ? 0 : IAVL_HEAVY);
+		c->link[d] &= ~IAVL_HEAVY;
+		iavl_set(p, ci);
+		return lower;
+	}
+
+	/*
+	 * c leans the other way, its inner child g comes up. What g
+	 * leaned towards ends up on the other side of a or c.
+	 */
+	gi = IAVL_IDX(c->link[!d]);
+	g = iavl_node(t, gi);
+	a->link[d] = IAVL_IDX(g->link[!d]);
+	a->link[!d] |= g->link[d] & IAVL_HEAVY;
+	c->link[!d] = IAVL_IDX(g->link[d]);
+	c->link[d] |= g->link[!d] & IAVL_HEAVY;
+	g->link[d] = ci;
+	g->link[!d] = ai;
+	iavl_set(p, gi);
+	return 1;
+}
+
+/* Which way did the path go from the node at *path[i]. */
+#define iavl_dir(t, path, i) \
+	((path)[(i) + 1] == &iavl_node(t, IAVL_IDX(*(path)[i]))->link[1])
+
+void
+iavl_link_internal(struct iavl_tree *t, uint32_t x, uint32_t **path, int depth)
+{
+	struct iavl_node *a;
+	int i, d;
+
+	a = iavl_node(t, x);
+	a->link[0] = a->link[1] = 0;
+	iavl_set(path[depth - 1], x);
+
+	/* The d side of a grew. */
+	for (i = depth - 2; i >= 0; i--) {
+		a = iavl_node(t, IAVL_IDX(*path[i]));
+		d = iavl_dir(t, path, i);
+		if (iavl_heavy(a, !d)) {
+			a->link[!d] &= ~IAVL_HEAVY;
+			return;
+		}
+		if (!iavl_heavy(a, d)) {
+			a->link[d] |= IAVL_HEAVY;
+			continue;
+		}
+		iavl_rotate(t, path[i], d);
+		return;
+	}
+}
+
+void
+iavl_unlink_internal(struct iavl_tree *t, uint32_t **path, int depth)
+{
+	uint32_t *p = path[depth - 1], *q, ri;
+	struct iavl_node *x, *a;
+	int at, i, d;
+
+	x = iavl_node(t, IAVL_IDX(*p));
+	if (IAVL_IDX(x->link[0]) == 0) {
+		iavl_set(p, IAVL_IDX(x->link[1]));
+	} else if (IAVL_IDX(x->link[1]) == 0) {
+		iavl_set(p, IAVL_IDX(x->link[0]));
+	} else {
+		/* The rightmost on the left takes the place of x. */
+		at = depth - 1;
+		q = &x->link[0];
+		path[depth++] = q;
+		while ((ri = IAVL_IDX(iavl_node(t, IAVL_IDX(*q))->link[1])) != 0) {
+			q = &iavl_node(t, IAVL_IDX(*q))->link[1];
+			path[depth++] = q;
+		}
+		ri = IAVL_IDX(*q);
+		a = iavl_node(t, ri);
+		iavl_set(q, IAVL_IDX(a->link[0]));
+		a->link[0] = x->link[0];
+		a->link[1] = x->link[1];
+		iavl_set(p, ri);
+		path[at + 1] = &a->link[0];
+	}
+
+	/* The d side of a got lower. */
+	for (i = depth - 2; i >= 0; i--) {
+		a = iavl_node(t, IAVL_IDX(*path[i]));
+		d = iavl_dir(t, path, i);
+		if (iavl_heavy(a, d)) {
+			a->link[d] &= ~IAVL_HEAVY;
+			continue;
+		}
+		if (!iavl_heavy(a, !d)) {
+			a->link[!d] |= IAVL_HEAVY;
+			return;
+		}
+		if (!iavl_rotate(t, path[i], !d))
+			return;
+	}
+}
+
+static int
+iavl_check_node(struct iavl_tree *t, uint32_t i)
+{
+	struct iavl_node *n;
+	int h0, h1;
+
+	if (i == 0)
+		return 0;
+	n = iavl_node(t, i);
+	assert(!(iavl_heavy(n, 0) && iavl_heavy(n, 1)));
+	h0 = iavl_check_node(t, IAVL_IDX(n->link[0]));
+	h1 = iavl_check_node(t, IAVL_IDX(n->link[1]));
+	assert(h0 - h1 == (iavl_heavy(n, 0) ? 1 : iavl_heavy(n, 1) ? -1 : 0));
+	return (h0 > h1 ? h0 : h1) + 1;
+}
+
+/*
+ * Check the balance bits against the real heights, return the height.
+ */
+int
+iavl_check(struct iavl_tree *t)
+{
+	return iavl_check_node(t, t->root);
+}
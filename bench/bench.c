@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "bench.h"
+
+#ifdef BENCH_HAVE_TSC
+#include <cpuid.h>
+#endif
+
+enum bench_timer bench_timer = BENCH_CLOCK;
+uint64_t bench_overhead;
+double bench_ns_per_tick = 1.0;
+
+static const char *timer_names[] = {
+	[BENCH_CLOCK] = "clock",
+	[BENCH_TSC] = "tsc",
+	[BENCH_PERF] = "perf",
+	[BENCH_MACH] = "mach",
+};
+
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+
+int bench_pmu_n;
+const char *bench_pmu_names[BENCH_PMU_MAX];
+uint64_t bench_pmu_overhead[BENCH_PMU_MAX];
+const char bench_pmu_list[] = "instructions,cycles,branches,branch-misses,"
+    "l1d-misses,llc-misses,dtlb-misses,page-faults";
+
+#ifdef __linux__
+struct pmc {
+	int fd;
+	volatile struct perf_event_mmap_page *pc;
+};
+
+static struct pmc perf_cycles = { -1, NULL };
+static struct pmc pmcs[BENCH_PMU_MAX];
+
+#define HWCACHE(c, r)	(PERF_COUNT_HW_CACHE_##c |			\
+	PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_##r << 16)
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} pmu_events[] = {
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "l1d-misses", PERF_TYPE_HW_CACHE, HWCACHE(L1D, MISS) },
+	{ "llc-misses", PERF_TYPE_HW_CACHE, HWCACHE(LL, MISS) },
+	{ "dtlb-misses", PERF_TYPE_HW_CACHE, HWCACHE(DTLB, MISS) },
+	{ "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+static int
+pmc_open(struct pmc *pmc, uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+	void *p;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	if ((pmc->fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)) == -1)
+		return -1;
+	p = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, pmc->fd, 0);
+	pmc->pc = p == MAP_FAILED ? NULL : p;
+	return 0;
+}
+
+/*
+ * The counter can be read without a system call if the kernel lets us
+ * use rdpmc. The kernel updates the offset whenever it touches the
+ * counter, lock works like a seqlock.
+ */
+static inline uint64_t
+pmc_read(struct pmc *pmc)
+{
+	volatile struct perf_event_mmap_page *pc = pmc->pc;
+	uint64_t count;
+
+#ifdef BENCH_HAVE_TSC
+	if (pc != NULL && pc->cap_user_rdpmc) {
+		uint32_t seq, idx;
+		int64_t v;
+
+		do {
+			seq = pc->lock;
+			__sync_synchronize();
+			idx = pc->index;
+			count = pc->offset;
+			if (idx == 0)
+				break;
+			v = __rdpmc(idx - 1);
+			v <<= 64 - pc->pmc_width;
+			v >>= 64 - pc->pmc_width;
+			count += v;
+			__sync_synchronize();
+		} while (pc->lock != seq);
+		if (idx != 0)
+			return count;
+	}
+#endif
+	if (read(pmc->fd, &count, sizeof(count)) != sizeof(count))
+		return 0;
+	return count;
+}
+
+uint64_t
+bench_perf_read(void)
+{
+	return pmc_read(&perf_cycles);
+}
+
+static int
+perf_init(void)
+{
+	if (perf_cycles.fd != -1)
+		return 0;
+	return pmc_open(&perf_cycles, PERF_TYPE_HARDWARE,
+	    PERF_COUNT_HW_CPU_CYCLES);
+}
+
+void
+bench_pmu_read(uint64_t *v)
+{
+	int i;
+
+	for (i = 0; i < bench_pmu_n; i++)
+		v[i] = pmc_read(&pmcs[i]);
+}
+
+static int
+pmu_open(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nitems(pmu_events); i++)
+		if (!strcmp(name, pmu_events[i].name))
+			break;
+	if (i == nitems(pmu_events)) {
+		warnx("unknown counter %s, have %s", name, bench_pmu_list);
+		return -1;
+	}
+	if (bench_pmu_n == BENCH_PMU_MAX) {
+		warnx("too many counters, %s left out", name);
+		return 0;
+	}
+	if (pmc_open(&pmcs[bench_pmu_n], pmu_events[i].type,
+	    pmu_events[i].config) == -1) {
+		warn("%s left out", name);
+		return 0;
+	}
+	bench_pmu_names[bench_pmu_n++] = pmu_events[i].name;
+	return 0;
+}
+#else
+uint64_t
+bench_perf_read(void)
+{
+	return 0;
+}
+
+static int
+perf_init(void)
+{
+	return -1;
+}
+
+void
+bench_pmu_read(uint64_t *v)
+{
+}
+
+static int
+pmu_open(const char *name)
+{
+	warnx("no counters here, %s left out", name);
+	return 0;
+}
+#endif
+
+#ifdef BENCH_HAVE_TSC
+/*
+ * Only an invariant TSC ticks at the same rate whatever the cpu is
+ * doing. Count ticks against the clock for a while to find the rate.
+ */
+static int
+tsc_init(void)
+{
+	unsigned int a, b, c, d;
+	uint64_t c0, c1, t0, t1;
+
+	if (__get_cpuid(0x80000007, &a, &b, &c, &d) == 0 || !(d & (1 << 8)))
+		return -1;
+	if (__get_cpuid(0x80000001, &a, &b, &c, &d) == 0 || !(d & (1 << 27)))
+		return -1;
+
+	bench_timer = BENCH_CLOCK;
+	c0 = bench_now();
+	t0 = __rdtscp(&a);
+	do {
+		c1 = bench_now();
+	} while (c1 - c0 < 50000000);
+	t1 = __rdtscp(&a);
+	bench_ns_per_tick = (double)(c1 - c0) / (double)(t1 - t0);
+	return 0;
+}
+#else
+static int
+tsc_init(void)
+{
+	return -1;
+}
+#endif
+
+static int
+mach_init(void)
+{
+#ifdef __MACH__
+	mach_timebase_info_data_t tb;
+
+	mach_timebase_info(&tb);
+	bench_ns_per_tick = (double)tb.numer / (double)tb.denom;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+static int
+u64_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * The overhead is the median of reading the timer twice in a row.
+ */
+#define OVERHEAD_SAMPLES 1001
+
+static void
+overhead_init(void)
+{
+	uint64_t samples[OVERHEAD_SAMPLES];
+	uint64_t s;
+	int i;
+
+	bench_overhead = 0;
+	for (i = 0; i < OVERHEAD_SAMPLES; i++) {
+		s = bench_now();
+		samples[i] = bench_now() - s;
+	}
+	qsort(samples, OVERHEAD_SAMPLES, sizeof(samples[0]), u64_cmp);
+	bench_overhead = samples[OVERHEAD_SAMPLES / 2];
+}
+
+int
+bench_timer_init(const char *name)
+{
+	enum bench_timer t;
+	int ret;
+
+	if (name == NULL)
+		name = timer_names[BENCH_CLOCK];
+	for (t = 0; t < nitems(timer_names); t++)
+		if (!strcmp(name, timer_names[t]))
+			break;
+	if (t == nitems(timer_names))
+		return -1;
+
+	bench_ns_per_tick = 1.0;
+	switch (t) {
+	case BENCH_TSC:
+		ret = tsc_init();
+		break;
+	case BENCH_PERF:
+		ret = perf_init();
+		break;
+	case BENCH_MACH:
+		ret = mach_init();
+		break;
+	default:
+		ret = 0;
+		break;
+	}
+	if (ret == -1) {
+		bench_ns_per_tick = 1.0;
+		bench_timer = BENCH_CLOCK;
+		return -1;
+	}
+	bench_timer = t;
+	overhead_init();
+	return 0;
+}
+
+/*
+ * What the counters count for an empty timed operation, the timer
+ * reads and the counter reads themselves, median like the timer.
+ */
+static void
+pmu_overhead_init(void)
+{
+	uint64_t samples[OVERHEAD_SAMPLES];
+	uint64_t a[BENCH_PMU_MAX], b[BENCH_PMU_MAX], s;
+	int i, j;
+
+	for (i = 0; i < bench_pmu_n; i++) {
+		bench_pmu_overhead[i] = 0;
+		for (j = 0; j < OVERHEAD_SAMPLES; j++) {
+			bench_pmu_read(a);
+			s = bench_now();
+			(void)bench_since(s);
+			bench_pmu_read(b);
+			samples[j] = b[i] - a[i];
+		}
+		qsort(samples, OVERHEAD_SAMPLES, sizeof(samples[0]), u64_cmp);
+		bench_pmu_overhead[i] = samples[OVERHEAD_SAMPLES / 2];
+	}
+}
+
+/*
+ * Call after bench_timer_init, the overhead depends on the timer.
+ */
+int
+bench_pmu_init(const char *list)
+{
+	char *l, *p, *name;
+	int ret = 0;
+
+	if ((l = strdup(list)) == NULL)
+		return -1;
+	for (p = l; (name = strsep(&p, ",")) != NULL;) {
+		if (*name == '\0')
+			continue;
+		if ((ret = pmu_open(name)) == -1)
+			break;
+	}
+	free(l);
+	if (ret == -1)
+		return -1;
+	pmu_overhead_init();
+	return bench_pmu_n;
+}
+
+const char *
+bench_timer_name(void)
+{
+	return timer_names[bench_timer];
+}
+
+/*
+ * The highest value that lands in the same bucket, HdrHistogram does
+ * the same. Never more than the largest value actually seen.
+ */
+uint64_t
+bench_hist_pct(const struct bench_hist *h, double pct)
+{
+	uint64_t want, seen = 0, v;
+	int i, e;
+
+	if (h->count == 0)
+		return 0;
+	want = (uint64_t)(pct / 100.0 * h->count + 0.5);
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+		if ((seen += h->b[i]) >= want)
+			break;
+	}
+	if (i < 2 * BENCH_HIST_SUB) {
+		v = i;
+	} else {
+		e = i / BENCH_HIST_SUB - 1;
+		v = ((uint64_t)(i % BENCH_HIST_SUB + BENCH_HIST_SUB) << e) +
+		    ((1ULL << e) - 1);
+	}
+	return v < h->max ? v : h->max;
+}
+
+/*
+ * xoshiro128** seeded through splitmix64.
+ */
+static uint32_t rnd[4] = { 1, 2, 3, 4 };
+
+void
+bench_seed(uint64_t seed)
+{
+	uint64_t z;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		z = (seed += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		rnd[i] = (uint32_t)(z ^ (z >> 31));
+	}
+}
+
+static inline uint32_t
+rotl(uint32_t x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+uint32_t
+bench_random(void)
+{
+	uint32_t r = rotl(rnd[1] * 5, 7) * 9;
+	uint32_t t = rnd[1] << 9;
+
+	rnd[2] ^= rnd[0];
+	rnd[3] ^= rnd[1];
+	rnd[1] ^= rnd[2];
+	rnd[0] ^= rnd[3];
+	rnd[2] ^= t;
+	rnd[3] = rotl(rnd[3], 11);
+	return r;
+}
+
+/*
+ * Uniform in [0, n) without modulo bias, like arc4random_uniform.
+ */
+uint32_t
+bench_random_uniform(uint32_t n)
+{
+	uint32_t r, min;
+
+	if (n < 2)
+		return 0;
+	min = -n % n;
+	do {
+		r = bench_random();
+	} while (r < min);
+	return r % n;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+#ifdef __MACH__
+#include <mach/mach_time.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC
+#endif
+
+/*
+ * Things the benchmarks share.
+ *
+ * Timers. bench_timer_init picks a timer by name:
+ *  "clock"	clock_gettime(CLOCK_MONOTONIC_RAW), the default.
+ *  "tsc"	rdtscp, the frequency is measured against "clock".
+ *  "perf"	the cpu cycle counter through perf_event, read with rdpmc
+ *		when the kernel allows it. The unit is cycles, not ns.
+ *  "mach"	mach_absolute_time.
+ * It returns -1 if the timer isn't available here.
+ *
+ * A timed operation is
+ *	s = bench_now();
+ *	op();
+ *	t += bench_since(s);
+ * and bench_ns(t) converts to ns. bench_since subtracts what it costs
+ * to read the timer twice, measured when the timer is set up, without
+ * that a 20ns operation is mostly the timer.
+ *
+ * Random numbers. A seeded generator so that runs can be repeated,
+ * bench_random_uniform works like arc4random_uniform.
+ *
+ * Histograms. A log-linear histogram of timer ticks, every power of
+ * two is split into BENCH_HIST_SUB linear buckets so a value is off by
+ * at most 1/BENCH_HIST_SUB. Adding a value is a few instructions, it
+ * can record every operation. bench_hist_pct returns the value below
+ * which pct percent of the values are.
+ *
+ * Counters. bench_pmu_init opens the comma separated list of hardware
+ * counters (see bench_pmu_list) in user mode only. A counter that
+ * perf_event can't give us is left out with a warning, bench_pmu_n is
+ * what we got, possibly 0. Around an operation
+ *	bench_pmu_start(p);
+ *	...timed op...
+ *	bench_pmu_stop(p, acc);
+ * adds what each counter counted to acc[i], minus what an empty timed
+ * op counts. Both do nothing when no counters are open.
+ */
+
+enum bench_timer {
+	BENCH_CLOCK,
+	BENCH_TSC,
+	BENCH_PERF,
+	BENCH_MACH,
+};
+
+extern enum bench_timer bench_timer;
+extern uint64_t bench_overhead;
+extern double bench_ns_per_tick;
+
+int bench_timer_init(const char *);
+const char *bench_timer_name(void);
+uint64_t bench_perf_read(void);
+
+#define BENCH_PMU_MAX	8
+
+extern int bench_pmu_n;
+extern const char *bench_pmu_names[BENCH_PMU_MAX];
+extern uint64_t bench_pmu_overhead[BENCH_PMU_MAX];
+extern const char bench_pmu_list[];
+
+int bench_pmu_init(const char *);
+void bench_pmu_read(uint64_t *);
+
+#define BENCH_HIST_SUB_BITS	5
+#define BENCH_HIST_SUB		(1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_BUCKETS	((64 - BENCH_HIST_SUB_BITS + 1) * BENCH_HIST_SUB)
+
+struct bench_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t b[BENCH_HIST_BUCKETS];
+};
+
+uint64_t bench_hist_pct(const struct bench_hist *, double);
+
+void bench_seed(uint64_t);
+uint32_t bench_random(void);
+uint32_t bench_random_uniform(uint32_t);
+
+static inline uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	switch (bench_timer) {
+#ifdef BENCH_HAVE_TSC
+	case BENCH_TSC: {
+		unsigned int aux;
+		return __rdtscp(&aux);
+	}
+#endif
+	case BENCH_PERF:
+		return bench_perf_read();
+#ifdef __MACH__
+	case BENCH_MACH:
+		return mach_absolute_time();
+#endif
+	default:
+		clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+}
+
+static inline uint64_t
+bench_since(uint64_t start)
+{
+	uint64_t d = bench_now() - start;
+
+	return d > bench_overhead ? d - bench_overhead : 0;
+}
+
+static inline double
+bench_ns(uint64_t ticks)
+{
+	return (double)ticks * bench_ns_per_tick;
+}
+
+/*
+ * Values below 2 * BENCH_HIST_SUB have a bucket each, above that the
+ * bucket is the top BENCH_HIST_SUB_BITS + 1 bits and the exponent.
+ */
+static inline void
+bench_hist_add(struct bench_hist *h, uint64_t v)
+{
+	int e;
+
+	h->count++;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+	if (v < 2 * BENCH_HIST_SUB) {
+		h->b[v]++;
+		return;
+	}
+	e = 63 - __builtin_clzll(v) - BENCH_HIST_SUB_BITS;
+	h->b[e * BENCH_HIST_SUB + (v >> e)]++;
+}
+
+static inline void
+bench_pmu_start(uint64_t *p)
+{
+	if (bench_pmu_n)
+		bench_pmu_read(p);
+}
+
+static inline void
+bench_pmu_stop(const uint64_t *p, uint64_t *acc)
+{
+	uint64_t now[BENCH_PMU_MAX], d;
+	int i;
+
+	if (bench_pmu_n == 0)
+		return;
+	bench_pmu_read(now);
+	for (i = 0; i < bench_pmu_n; i++) {
+		d = now[i] - p[i];
+		acc[i] += d > bench_pmu_overhead[i] ? d - bench_pmu_overhead[i] : 0;
+	}
+}
+
+#endif /*BENCH_H*/
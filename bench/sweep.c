@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Runs a benchmark once for every size of a sweep, in parallel.
+ *
+ *	sweep [-l] [-c cpus] [-j jobs] [-k reps] [-o out] [-p sizes] cmd [arg ...]
+ *
+ * The size replaces an argument that is "{}", or is added at the end.
+ * Every run is its own process pinned to its own cpu, -c picks the
+ * cpus (like "2-7,10"), the default is all the cpus we may run on. A
+ * run never shares a cpu with another run, so -j more than the cpus
+ * doesn't do anything.
+ *
+ * Every size is run -k times, the repetitions of a size are spread out
+ * in time. The output of a run is lines of numbers, we print the median
+ * of every number over the repetitions, in the order of the sizes and
+ * the same format the benchmark has so the plot files work. After that
+ * come the low and high end of a 95% confidence interval for the median
+ * of each number but the first. A word that isn't a number is taken
+ * from the first repetition.
+ *
+ * The sizes are the ones heap_test and totest sweep over, or a comma
+ * separated list with -p. -l prints the sizes and exits.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+
+static int tests[] = {
+	10, 20, 50, 100, 200, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000
+};
+
+static int *sizes;
+static int nsizes;
+
+static void
+add_size(int n)
+{
+	if ((sizes = reallocarray(sizes, nsizes + 1, sizeof(*sizes))) == NULL)
+		err(1, "reallocarray");
+	sizes[nsizes++] = n;
+}
+
+/* The same as main() in heap_test and totest. */
+static void
+default_sizes(void)
+{
+	int i, j, steps, distance;
+
+	for (i = 0; i < nitems(tests) - 1; i++) {
+		distance = tests[i + 1] - tests[i];
+		steps = distance > 20 ? 20 : distance;
+		for (j = 0; j < steps; j++)
+			add_size(((tests[i + 1] - tests[i]) / steps) * j + tests[i]);
+	}
+}
+
+static int *cpus;
+static int ncpus;
+
+static void
+add_cpu(int c)
+{
+	if ((cpus = reallocarray(cpus, ncpus + 1, sizeof(*cpus))) == NULL)
+		err(1, "reallocarray");
+	cpus[ncpus++] = c;
+}
+
+static void
+parse_cpus(char *s)
+{
+	char *p, *e;
+	int lo, hi;
+
+	while ((p = strsep(&s, ",")) != NULL) {
+		if (*p == '\0')
+			continue;
+		lo = hi = strtol(p, &e, 10);
+		if (*e == '-')
+			hi = strtol(e + 1, &e, 10);
+		if (*e != '\0' || lo < 0 || hi < lo)
+			errx(1, "bad cpu list");
+		for (; lo <= hi; lo++)
+			add_cpu(lo);
+	}
+}
+
+static void
+default_cpus(void)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	int i;
+
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (i = 0; i < CPU_SETSIZE; i++)
+			if (CPU_ISSET(i, &set))
+				add_cpu(i);
+		return;
+	}
+#endif
+	add_cpu(0);
+}
+
+static void
+pin(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) == -1)
+		err(1, "sched_setaffinity %d", cpu);
+#endif
+}
+
+/*
+ * One run. The output goes to a temporary file that we read when the
+ * process is done.
+ */
+struct run {
+	int size;
+	int rep;
+	FILE *out;
+	pid_t pid;
+	int cpu;
+	char **lines;
+	int nlines;
+};
+
+static void
+start(struct run *r, int cpu, char **cmd, int sizearg)
+{
+	char buf[16];
+
+	snprintf(buf, sizeof(buf), "%d", r->size);
+	if ((r->out = tmpfile()) == NULL)
+		err(1, "tmpfile");
+	r->cpu = cpu;
+	fflush(stdout);
+	switch (r->pid = fork()) {
+	case -1:
+		err(1, "fork");
+	case 0:
+		pin(cpu);
+		if (dup2(fileno(r->out), STDOUT_FILENO) == -1)
+			err(1, "dup2");
+		cmd[sizearg] = buf;
+		execvp(cmd[0], cmd);
+		err(1, "%s", cmd[0]);
+	}
+}
+
+static void
+finish(struct run *r, int status)
+{
+	char *line = NULL;
+	size_t sz = 0;
+	ssize_t len;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(1, "size %d rep %d failed", r->size, r->rep);
+	rewind(r->out);
+	while ((len = getline(&line, &sz, r->out)) != -1) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		if ((r->lines = reallocarray(r->lines, r->nlines + 1,
+		    sizeof(*r->lines))) == NULL)
+			err(1, "reallocarray");
+		if ((r->lines[r->nlines++] = strdup(line)) == NULL)
+			err(1, "strdup");
+	}
+	free(line);
+	fclose(r->out);
+	r->out = NULL;
+}
+
+static int
+dcmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+#define MAXWORDS 256
+
+/*
+ * Median of sorted v[0..k-1] and the order statistics that bound it
+ * with 95% confidence. Below 6 repetitions that is min and max.
+ */
+static void
+median_ci(double *v, int k, double *med, double *lo, double *hi)
+{
+	int l, h;
+
+	qsort(v, k, sizeof(*v), dcmp);
+	*med = k & 1 ? v[k / 2] : (v[k / 2 - 1] + v[k / 2]) / 2;
+	l = floor((k - 1.96 * sqrt(k)) / 2);
+	h = ceil(1 + (k + 1.96 * sqrt(k)) / 2) - 1;
+	if (l < 0)
+		l = 0;
+	if (h > k - 1)
+		h = k - 1;
+	*lo = v[l];
+	*hi = v[h];
+}
+
+static int
+split(char *line, char **words)
+{
+	char *w;
+	int n = 0;
+
+	while ((w = strsep(&line, " \t")) != NULL)
+		if (*w != '\0' && n < MAXWORDS)
+			words[n++] = w;
+	return n;
+}
+
+/*
+ * Merge line n of the k repetitions of one size. A number that is the
+ * same in every repetition, like the size, is printed as it is.
+ */
+static void
+merge(FILE *f, struct run **reps, int k, int n)
+{
+	char *copy[k], *words[k][MAXWORDS], *e;
+	double v[k], lo[MAXWORDS], hi[MAXWORDS], med;
+	int isnum[MAXWORDS];
+	int nw = 0, i, j, same;
+
+	for (j = 0; j < k; j++) {
+		if ((copy[j] = strdup(reps[j]->lines[n])) == NULL)
+			err(1, "strdup");
+		i = split(copy[j], words[j]);
+		if (j == 0)
+			nw = i;
+		else if (i != nw)
+			errx(1, "size %d: runs disagree", reps[0]->size);
+	}
+
+	for (i = 0; i < nw; i++) {
+		strtod(words[0][i], &e);
+		isnum[i] = *e == '\0';
+		same = 1;
+		for (j = 0; j < k; j++) {
+			v[j] = strtod(words[j][i], NULL);
+			same &= !strcmp(words[j][i], words[0][i]);
+		}
+		if (isnum[i])
+			median_ci(v, k, &med, &lo[i], &hi[i]);
+		if (!isnum[i] || same)
+			fprintf(f, "%s%s", i ? " " : "", words[0][i]);
+		else
+			fprintf(f, "%s%f", i ? " " : "", med);
+	}
+	for (i = 1; i < nw; i++)
+		if (isnum[i])
+			fprintf(f, " %f %f", lo[i], hi[i]);
+	fprintf(f, "\n");
+	for (j = 0; j < k; j++)
+		free(copy[j]);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: sweep [-l] [-c cpus] [-j jobs] [-k reps] [-o out] [-p sizes] cmd [arg ...]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct run *runs, *r, **reps;
+	const char *out = NULL;
+	char **cmd, *p, *s;
+	int *busy;
+	int list = 0, jobs = 0, k = 3;
+	int i, j, n, ch, sizearg, next, running, done, status;
+	FILE *f;
+	pid_t pid;
+
+	while ((ch = getopt(argc, argv, "+c:j:k:lo:p:")) != -1) {
+		switch (ch) {
+		case 'c':
+			parse_cpus(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'k':
+			if ((k = atoi(optarg)) < 1)
+				usage();
+			break;
+		case 'l':
+			list = 1;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'p':
+			for (s = optarg; (p = strsep(&s, ",")) != NULL;)
+				if (*p != '\0')
+					add_size(atoi(p));
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (nsizes == 0)
+		default_sizes();
+	if (list) {
+		for (i = 0; i < nsizes; i++)
+			printf("%d\n", sizes[i]);
+		return 0;
+	}
+	if (argc == 0)
+		usage();
+	if (ncpus == 0)
+		default_cpus();
+	if (jobs <= 0 || jobs > ncpus)
+		jobs = ncpus;
+
+	/* Room for the size at the end and the NULL. */
+	if ((cmd = calloc(argc + 2, sizeof(*cmd))) == NULL)
+		err(1, "calloc");
+	sizearg = argc;
+	for (i = 0; i < argc; i++) {
+		cmd[i] = argv[i];
+		if (!strcmp(argv[i], "{}"))
+			sizearg = i;
+	}
+
+	/* Repetition major, the runs of one size are far apart. */
+	if ((runs = calloc(nsizes * k, sizeof(*runs))) == NULL)
+		err(1, "calloc");
+	for (j = 0; j < k; j++) {
+		for (i = 0; i < nsizes; i++) {
+			runs[j * nsizes + i].size = sizes[i];
+			runs[j * nsizes + i].rep = j;
+		}
+	}
+	if ((busy = calloc(ncpus, sizeof(*busy))) == NULL)
+		err(1, "calloc");
+
+	next = running = done = 0;
+	n = nsizes * k;
+	while (done < n) {
+		while (running < jobs && next < n) {
+			for (i = 0; busy[i]; i++)
+				;
+			busy[i] = 1;
+			start(&runs[next++], cpus[i], cmd, sizearg);
+			running++;
+		}
+		if ((pid = wait(&status)) == -1)
+			err(1, "wait");
+		for (r = runs; r < runs + next && r->pid != pid; r++)
+			;
+		if (r == runs + next)
+			continue;
+		for (i = 0; cpus[i] != r->cpu || !busy[i]; i++)
+			;
+		busy[i] = 0;
+		r->pid = 0;
+		finish(r, status);
+		running--;
+		done++;
+		fprintf(stderr, "\r%d/%d", done, n);
+	}
+	fprintf(stderr, "\n");
+
+	if (out == NULL)
+		f = stdout;
+	else if ((f = fopen(out, "w")) == NULL)
+		err(1, "%s", out);
+	if ((reps = calloc(k, sizeof(*reps))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < nsizes; i++) {
+		for (j = 0; j < k; j++) {
+			reps[j] = &runs[j * nsizes + i];
+			if (reps[j]->nlines != reps[0]->nlines)
+				errx(1, "size %d: runs disagree", sizes[i]);
+		}
+		for (j = 0; j < reps[0]->nlines; j++)
+			merge(f, reps, k, j);
+	}
+	if (f != stdout && fclose(f) == EOF)
+		err(1, "%s", out);
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+int
+trace_writer_open(struct trace_writer *tw, const char *path)
+{
+	struct trace_hdr th;
+
+	memset(tw, 0, sizeof(*tw));
+	if ((tw->tw_f = fopen(path, "w")) == NULL)
+		return -1;
+	/* Filled in on close. */
+	memset(&th, 0, sizeof(th));
+	if (fwrite(&th, sizeof(th), 1, tw->tw_f) != 1) {
+		fclose(tw->tw_f);
+		return -1;
+	}
+	return 0;
+}
+
+void
+trace_write(struct trace_writer *tw, int op, uint32_t id, int32_t key)
+{
+	struct trace_rec tr;
+
+	tr.tr_opid = (uint32_t)op << TRACE_IDBITS | (id & TRACE_MAXID);
+	tr.tr_key = key;
+	if (op != TRACE_TICK && id >= tw->tw_nid)
+		tw->tw_nid = id + 1;
+	fwrite(&tr, sizeof(tr), 1, tw->tw_f);
+	tw->tw_nrec++;
+}
+
+int
+trace_writer_close(struct trace_writer *tw)
+{
+	struct trace_hdr th;
+	int ret = 0;
+
+	memset(&th, 0, sizeof(th));
+	th.th_magic = TRACE_MAGIC;
+	th.th_version = TRACE_VERSION;
+	th.th_nrec = tw->tw_nrec;
+	th.th_nid = tw->tw_nid;
+	if (fflush(tw->tw_f) == EOF || fseek(tw->tw_f, 0, SEEK_SET) == -1 ||
+	    fwrite(&th, sizeof(th), 1, tw->tw_f) != 1)
+		ret = -1;
+	if (fclose(tw->tw_f) == EOF)
+		ret = -1;
+	return ret;
+}
+
+int
+trace_open(struct trace *t, const char *path)
+{
+	const struct trace_hdr *th;
+	struct stat st;
+	int fd;
+
+	memset(t, 0, sizeof(*t));
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < (off_t)sizeof(*th)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	t->t_len = st.st_size;
+	t->t_map = mmap(NULL, t->t_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (t->t_map == MAP_FAILED)
+		return -1;
+#ifdef MADV_SEQUENTIAL
+	madvise(t->t_map, t->t_len, MADV_SEQUENTIAL);
+#endif
+	th = t->t_map;
+	if (th->th_magic != TRACE_MAGIC || th->th_version != TRACE_VERSION ||
+	    th->th_nrec != (t->t_len - sizeof(*th)) / sizeof(struct trace_rec)) {
+		trace_close(t);
+		errno = EINVAL;
+		return -1;
+	}
+	t->t_rec = (const struct trace_rec *)(th + 1);
+	t->t_nrec = th->th_nrec;
+	t->t_nid = th->th_nid;
+	return 0;
+}
+
+void
+trace_close(struct trace *t)
+{
+	munmap(t->t_map, t->t_len);
+	t->t_map = NULL;
+}
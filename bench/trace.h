@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Workload traces. A header and then fixed size records, each an
+ * operation on one element (or timeout) identified by a small integer.
+ *
+ *  TRACE_INSERT	schedule id key ticks from now
+ *  TRACE_UPDATE	reschedule a scheduled id key ticks from now
+ *  TRACE_REMOVE	unschedule id
+ *  TRACE_TICK		the clock moves key ticks, everything that is
+ *			due is removed
+ *
+ * This is the timeout API so that traces recorded from timeouts can be
+ * replayed in the heaps, the keys are relative. Everything is in host
+ * byte order, the traces are not meant to move between machines.
+ *
+ * Traces are written through a stdio buffer and read with mmap, the
+ * replay loops walk the records directly in the mapping.
+ */
+
+#define TRACE_MAGIC	0x54524345	/* TRCE */
+#define TRACE_VERSION	1
+
+struct trace_hdr {
+	uint32_t th_magic;
+	uint32_t th_version;
+	uint64_t th_nrec;
+	uint32_t th_nid;		/* ids are 0 to th_nid - 1 */
+	uint32_t th_pad;
+};
+
+struct trace_rec {
+	uint32_t tr_opid;		/* op in the top two bits */
+	int32_t tr_key;
+};
+
+#define TRACE_INSERT	0
+#define TRACE_UPDATE	1
+#define TRACE_REMOVE	2
+#define TRACE_TICK	3
+
+#define TRACE_IDBITS	30
+#define TRACE_MAXID	((1U << TRACE_IDBITS) - 1)
+#define TRACE_OP(r)	((r)->tr_opid >> TRACE_IDBITS)
+#define TRACE_ID(r)	((r)->tr_opid & TRACE_MAXID)
+
+struct trace_writer {
+	FILE *tw_f;
+	uint64_t tw_nrec;
+	uint32_t tw_nid;
+};
+
+int trace_writer_open(struct trace_writer *, const char *);
+void trace_write(struct trace_writer *, int, uint32_t, int32_t);
+int trace_writer_close(struct trace_writer *);
+
+struct trace {
+	void *t_map;
+	size_t t_len;
+	const struct trace_rec *t_rec;
+	uint64_t t_nrec;
+	uint32_t t_nid;
+};
+
+int trace_open(struct trace *, const char *);
+void trace_close(struct trace *);
+
+#endif /*TRACE_H*/
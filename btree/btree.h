@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef __BTREE_H__
+#define __BTREE_H__
+
+#include <stdint.h>
+
+/*
+ * B+tree of (key, value) pairs, the same things as avl.h but for when
+ * the tree doesn't fit in the cache.
+ *
+ * The avl compares nodes through a callback and every step down the
+ * tree is a node somewhere else in memory. Here the keys are integers
+ * kept in the tree nodes, a step down is one node of BTREE_ORDER keys
+ * next to each other, a few cache lines, so a tree of a million keys
+ * is five nodes deep instead of twenty.
+ *
+ * Entries are ordered by key and then by the value as an integer, so
+ * many values can have the same key (like timeouts with the same
+ * time) but the same pair can only be in the tree once. Lookup and
+ * search only look at the key.
+ *
+ * The tree nodes are allocated by the tree, btree_insert returns -1
+ * with errno set when it can't get memory. The values are never
+ * touched.
+ *
+ * The leaves are linked in order, btree_first is the smallest entry
+ * without going down the tree and the iterator is a walk along the
+ * leaves.
+ */
+
+#ifndef BTREE_ORDER
+#define BTREE_ORDER	16
+#endif
+
+struct btree_leaf;
+
+struct btree {
+	void *root;
+	struct btree_leaf *first;
+	int height;			/* 0 empty, 1 the root is a leaf */
+	long count;
+};
+
+#define BTREE_INITIALIZER { NULL, NULL, 0, 0 }
+
+struct btree_it {
+	struct btree_leaf *l;
+	int i;
+	int has_e;
+	int ince;
+	int64_t e;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void btree_init(struct btree *);
+void btree_destroy(struct btree *);
+int btree_insert(struct btree *, int64_t, void *);
+int btree_delete(struct btree *, int64_t, void *);
+void *btree_lookup(const struct btree *, int64_t);
+void *btree_search(const struct btree *, int64_t, int64_t *);
+void *btree_first(const struct btree *, int64_t *);
+void btree_check(const struct btree *);
+size_t btree_memsize(const struct btree *);
+
+void btree_it_init(struct btree_it *, const struct btree *, const int64_t *,
+    const int64_t *);
+void btree_it_init2(struct btree_it *, const struct btree *, const int64_t *,
+    const int64_t *, int);
+void *btree_it_next(struct btree_it *, int64_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
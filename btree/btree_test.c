@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avl.h"
+#include "btree.h"
+#include "bench.h"
+
+/*
+ * The avl and the B+tree side by side. The same random keys go into
+ * both, then we look all of them up in random order, walk the whole
+ * tree with the iterator and delete everything in random order. The
+ * numbers are ns per operation and then the bytes per element that
+ * the tree itself takes.
+ *
+ * Small trees are done many times over so that every size does about
+ * the same number of operations.
+ */
+
+struct el {
+	struct avl_node link;
+	int64_t key;
+};
+
+static int
+el_cmp(const struct avl_node *an, const struct avl_node *bn)
+{
+	const struct el *a = avl_data(an, struct el, link);
+	const struct el *b = avl_data(bn, struct el, link);
+
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return (a > b) - (a < b);
+}
+
+/* For lookups, the key is enough and the order is the same. */
+static int
+el_key_cmp(const struct avl_node *an, const struct avl_node *bn)
+{
+	const struct el *a = avl_data(an, struct el, link);
+	const struct el *b = avl_data(bn, struct el, link);
+
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+struct result {
+	double ins, look, scan, del, bytes;
+};
+
+static void
+shuffle(int *order, int n)
+{
+	int i, j, t;
+
+	for (i = n - 1; i > 0; i--) {
+		j = bench_random_uniform(i + 1);
+		t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+}
+
+static void
+run_avl(struct el *elems, const int *order, int n, struct result *r)
+{
+	struct avl_node *root = NULL, *an;
+	struct avl_it it;
+	struct el s;
+	uint64_t start;
+	int i, found = 0;
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		avl_insert(&elems[i].link, &root, el_cmp);
+	r->ins += bench_ns(bench_since(start));
+
+	start = bench_now();
+	for (i = 0; i < n; i++) {
+		s.key = elems[order[i]].key;
+		found += avl_lookup(&s.link, &root, el_key_cmp) != NULL;
+	}
+	r->look += bench_ns(bench_since(start));
+	assert(found == n);
+
+	start = bench_now();
+	avl_it_init(&it, root, NULL, NULL, el_cmp);
+	for (i = 0; (an = avl_it_next(&it)) != NULL; i++)
+		;
+	r->scan += bench_ns(bench_since(start));
+	assert(i == n);
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		avl_delete(&elems[order[i]].link, &root, el_cmp);
+	r->del += bench_ns(bench_since(start));
+	assert(root == NULL);
+
+	r->bytes = sizeof(struct avl_node);
+}
+
+static void
+run_btree(struct el *elems, const int *order, int n, struct result *r)
+{
+	struct btree t = BTREE_INITIALIZER;
+	struct btree_it it;
+	uint64_t start;
+	int i, found = 0;
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		if (btree_insert(&t, elems[i].key, &elems[i]) == -1)
+			err(1, "btree_insert");
+	r->ins += bench_ns(bench_since(start));
+	r->bytes = (double)btree_memsize(&t) / n;
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		found += btree_lookup(&t, elems[order[i]].key) != NULL;
+	r->look += bench_ns(bench_since(start));
+	assert(found == n);
+
+	start = bench_now();
+	btree_it_init(&it, &t, NULL, NULL);
+	for (i = 0; btree_it_next(&it, NULL) != NULL; i++)
+		;
+	r->scan += bench_ns(bench_since(start));
+	assert(i == n);
+
+	start = bench_now();
+	for (i = 0; i < n; i++)
+		btree_delete(&t, elems[order[i]].key, &elems[order[i]]);
+	r->del += bench_ns(bench_since(start));
+	assert(t.root == NULL);
+}
+
+static void
+print_result(const struct result *r, double nops)
+{
+	printf(" %f %f %f %f %f", r->ins / nops, r->look / nops,
+	    r->scan / nops, r->del / nops, r->bytes);
+}
+
+static void
+run_one(int n)
+{
+	struct result ra, rb;
+	struct el *elems;
+	int *order;
+	int i, rep, reps;
+
+	if ((elems = calloc(n, sizeof(*elems))) == NULL)
+		err(1, "calloc");
+	if ((order = calloc(n, sizeof(*order))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < n; i++)
+		order[i] = i;
+
+	reps = n < 1000000 ? 1000000 / n : 1;
+	memset(&ra, 0, sizeof(ra));
+	memset(&rb, 0, sizeof(rb));
+	for (rep = 0; rep < reps; rep++) {
+		for (i = 0; i < n; i++)
+			elems[i].key = ((int64_t)bench_random() << 31) ^ bench_random();
+		shuffle(order, n);
+		run_avl(elems, order, n, &ra);
+		run_btree(elems, order, n, &rb);
+	}
+
+	printf("%d", n);
+	print_result(&ra, (double)n * reps);
+	print_result(&rb, (double)n * reps);
+	printf("\n");
+	fflush(stdout);
+
+	free(order);
+	free(elems);
+}
+
+#ifndef nitems
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+#endif
+int tests[] = {
+	1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000,
+	2000000, 5000000, 10000000
+};
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: btree_test [-s seed] [-T timer] [nelem]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *timer = "clock";
+	int ch, i;
+
+	while ((ch = getopt(argc, argv, "s:T:")) != -1) {
+		switch (ch) {
+		case 's':
+			bench_seed(strtoull(optarg, NULL, 0));
+			break;
+		case 'T':
+			timer = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (bench_timer_init(timer) == -1)
+		errx(1, "timer %s not available", timer);
+
+	printf("# nelem, then insert lookup scan delete bytes of avl btree\n");
+	if (argc == 1) {
+		run_one(atoi(argv[0]));
+		return 0;
+	}
+	for (i = 0; i < nitems(tests); i++)
+		run_one(tests[i]);
+
+	return 0;
+}
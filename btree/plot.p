@@ -0,0 +1,11 @@
+set autoscale
+set xtic auto
+set ytic auto
+set ylabel "time per lookup (ns)"
+set yrange [0:]
+set xlabel "elements"
+set logscale x
+# Five columns per tree after nelem, lookup is the second.
+file = "test.out"
+plot file using 1:3 title "avl" with lines, \
+     file using 1:8 title "btree" with lines
@@ -0,0 +1,607 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btree.h"
+
+/*
+ * A leaf has up to BTREE_ORDER entries, an inner node up to
+ * BTREE_ORDER children and one separator less. Everything in child i
+ * is below separator i, everything in child i + 1 is above or equal.
+ * The separators are copies of entries that were the first in a leaf
+ * at some point, they don't have to be in the tree anymore.
+ *
+ * Everything except the root is at least half full, a leaf that gets
+ * below that borrows from a neighbour or is merged into it.
+ */
+#define LEAF_MAX	BTREE_ORDER
+#define LEAF_MIN	(BTREE_ORDER / 2)
+#define INNER_MAX	(BTREE_ORDER - 1)
+#define INNER_MIN	((BTREE_ORDER - 1) / 2)
+
+struct btree_leaf {
+	int n;
+	int64_t key[LEAF_MAX];
+	void *val[LEAF_MAX];
+	struct btree_leaf *next;
+};
+
+struct btree_inner {
+	int n;
+	int64_t key[INNER_MAX];
+	void *val[INNER_MAX];
+	void *child[INNER_MAX + 1];
+};
+
+/* Both start with n. */
+#define bt_n(node) (*(int *)(node))
+
+/* Even at BTREE_ORDER 4 that's more than 2^32 entries. */
+#define BTREE_MAXDEPTH	32
+
+/* (ak, av) < (bk, bv) */
+static inline int
+bt_lt(int64_t ak, const void *av, int64_t bk, const void *bv)
+{
+	return ak < bk || (ak == bk && (uintptr_t)av < (uintptr_t)bv);
+}
+
+/*
+ * The first entry not below (k, v). The keys are next to each other
+ * and there are only BTREE_ORDER of them, a linear scan is as fast as
+ * anything smarter.
+ */
+static inline int
+leaf_pos(const struct btree_leaf *l, int64_t k, const void *v)
+{
+	int i;
+
+	for (i = 0; i < l->n && bt_lt(l->key[i], l->val[i], k, v); i++)
+		;
+	return i;
+}
+
+/* The child that (k, v) belongs to. */
+static inline int
+inner_pos(const struct btree_inner *in, int64_t k, const void *v)
+{
+	int i;
+
+	for (i = 0; i < in->n && !bt_lt(k, v, in->key[i], in->val[i]); i++)
+		;
+	return i;
+}
+
+/*
+ * The leaf where (k, v) is or would be. With v NULL that's the leaf
+ * where the first entry with key k or above is, if it's anywhere.
+ */
+static struct btree_leaf *
+bt_leaf(const struct btree *t, int64_t k, const void *v)
+{
+	void *n = t->root;
+	int h;
+
+	for (h = t->height; h > 1; h--) {
+		struct btree_inner *in = n;
+		n = in->child[inner_pos(in, k, v)];
+	}
+	return n;
+}
+
+void
+btree_init(struct btree *t)
+{
+	memset(t, 0, sizeof(*t));
+}
+
+static void
+bt_free(void *n, int h)
+{
+	struct btree_inner *in = n;
+	int i;
+
+	if (h > 1)
+		for (i = 0; i <= in->n; i++)
+			bt_free(in->child[i], h - 1);
+	free(n);
+}
+
+void
+btree_destroy(struct btree *t)
+{
+	if (t->root != NULL)
+		bt_free(t->root, t->height);
+	btree_init(t);
+}
+
+/*
+ * Put (k, v) at i in a leaf that has room.
+ */
+static void
+leaf_put(struct btree_leaf *l, int i, int64_t k, void *v)
+{
+	memmove(&l->key[i + 1], &l->key[i], (l->n - i) * sizeof(l->key[0]));
+	memmove(&l->val[i + 1], &l->val[i], (l->n - i) * sizeof(l->val[0]));
+	l->key[i] = k;
+	l->val[i] = v;
+	l->n++;
+}
+
+/*
+ * Put separator (k, v) at i and the child right of it at i + 1 in an
+ * inner node that has room.
+ */
+static void
+inner_put(struct btree_inner *in, int i, int64_t k, void *v, void *c)
+{
+	memmove(&in->key[i + 1], &in->key[i], (in->n - i) * sizeof(in->key[0]));
+	memmove(&in->val[i + 1], &in->val[i], (in->n - i) * sizeof(in->val[0]));
+	memmove(&in->child[i + 2], &in->child[i + 1], (in->n - i) * sizeof(in->child[0]));
+	in->key[i] = k;
+	in->val[i] = v;
+	in->child[i + 1] = c;
+	in->n++;
+}
+
+/*
+ * Split a full inner node with the separator (*k, *v) and child c
+ * going in at i. The upper half goes to r and the middle separator
+ * that moves up is returned in *k, *v.
+ */
+static void
+inner_split(struct btree_inner *in, struct btree_inner *r, int i,
+    int64_t *k, void **v, void *c)
+{
+	int64_t tk[INNER_MAX + 1];
+	void *tv[INNER_MAX + 1], *tc[INNER_MAX + 2];
+	int m;
+
+	memcpy(tk, in->key, i * sizeof(tk[0]));
+	memcpy(tv, in->val, i * sizeof(tv[0]));
+	memcpy(tc, in->child, (i + 1) * sizeof(tc[0]));
+	tk[i] = *k;
+	tv[i] = *v;
+	tc[i + 1] = c;
+	memcpy(&tk[i + 1], &in->key[i], (INNER_MAX - i) * sizeof(tk[0]));
+	memcpy(&tv[i + 1], &in->val[i], (INNER_MAX - i) * sizeof(tv[0]));
+	memcpy(&tc[i + 2], &in->child[i + 1], (INNER_MAX - i) * sizeof(tc[0]));
+
+	m = (INNER_MAX + 1) / 2;
+	in->n = m;
+	memcpy(in->key, tk, m * sizeof(tk[0]));
+	memcpy(in->val, tv, m * sizeof(tv[0]));
+	memcpy(in->child, tc, (m + 1) * sizeof(tc[0]));
+	r->n = INNER_MAX - m;
+	memcpy(r->key, &tk[m + 1], r->n * sizeof(tk[0]));
+	memcpy(r->val, &tv[m + 1], r->n * sizeof(tv[0]));
+	memcpy(r->child, &tc[m + 1], (r->n + 1) * sizeof(tc[0]));
+	*k = tk[m];
+	*v = tv[m];
+}
+
+/*
+ * One walk down that remembers the way. When the leaf is full it
+ * splits, then every full inner node above it and maybe the root. All
+ * the nodes for that are allocated before anything is changed so that
+ * running out of memory doesn't leave half a split behind.
+ */
+int
+btree_insert(struct btree *t, int64_t k, void *v)
+{
+	struct btree_inner *path[BTREE_MAXDEPTH], *in, *spare[BTREE_MAXDEPTH];
+	int pos[BTREE_MAXDEPTH];
+	struct btree_leaf *l, *r;
+	void *n, *right;
+	int h, i, m, need;
+
+	if (t->root == NULL) {
+		if ((l = malloc(sizeof(*l))) == NULL)
+			return -1;
+		l->n = 0;
+		l->next = NULL;
+		t->root = t->first = l;
+		t->height = 1;
+	}
+
+	for (n = t->root, h = t->height; h > 1; h--) {
+		path[h] = n;
+		pos[h] = inner_pos(n, k, v);
+		n = path[h]->child[pos[h]];
+	}
+	l = n;
+	i = leaf_pos(l, k, v);
+	assert(i == l->n || l->key[i] != k || l->val[i] != v);
+	t->count++;
+	if (l->n < LEAF_MAX) {
+		leaf_put(l, i, k, v);
+		return 0;
+	}
+
+	for (need = 0, h = 2; h <= t->height && path[h]->n == INNER_MAX; h++)
+		need++;
+	if (h > t->height)
+		need++;
+	if ((r = malloc(sizeof(*r))) == NULL)
+		goto fail;
+	for (m = 0; m < need; m++) {
+		if ((spare[m] = malloc(sizeof(*spare[m]))) == NULL) {
+			while (m > 0)
+				free(spare[--m]);
+			free(r);
+			goto fail;
+		}
+	}
+
+	m = LEAF_MAX / 2;
+	r->n = LEAF_MAX - m;
+	memcpy(r->key, &l->key[m], r->n * sizeof(l->key[0]));
+	memcpy(r->val, &l->val[m], r->n * sizeof(l->val[0]));
+	l->n = m;
+	r->next = l->next;
+	l->next = r;
+	if (i < m)
+		leaf_put(l, i, k, v);
+	else
+		leaf_put(r, i - m, k, v);
+	k = r->key[0];
+	v = r->val[0];
+	right = r;
+
+	for (h = 2; h <= t->height; h++) {
+		in = path[h];
+		if (in->n < INNER_MAX) {
+			inner_put(in, pos[h], k, v, right);
+			return 0;
+		}
+		inner_split(in, spare[--need], pos[h], &k, &v, right);
+		right = spare[need];
+	}
+
+	assert(need == 1);
+	in = spare[0];
+	in->n = 1;
+	in->key[0] = k;
+	in->val[0] = v;
+	in->child[0] = t->root;
+	in->child[1] = right;
+	t->root = in;
+	t->height++;
+	return 0;
+fail:
+	t->count--;
+	return -1;
+}
+
+/*
+ * Child i of p is below the minimum, borrow from a neighbour or merge
+ * with it.
+ */
+static void
+bt_fix(struct btree_inner *p, int i, int h)
+{
+	if (h == 1) {
+		struct btree_leaf *c = p->child[i], *s;
+
+		if (i > 0 && (s = p->child[i - 1])->n > LEAF_MIN) {
+			memmove(&c->key[1], &c->key[0], c->n * sizeof(c->key[0]));
+			memmove(&c->val[1], &c->val[0], c->n * sizeof(c->val[0]));
+			c->key[0] = s->key[s->n - 1];
+			c->val[0] = s->val[s->n - 1];
+			c->n++;
+			s->n--;
+			p->key[i - 1] = c->key[0];
+			p->val[i - 1] = c->val[0];
+			return;
+		}
+		if (i < p->n && (s = p->child[i + 1])->n > LEAF_MIN) {
+			c->key[c->n] = s->key[0];
+			c->val[c->n] = s->val[0];
+			c->n++;
+			s->n--;
+			memmove(&s->key[0], &s->key[1], s->n * sizeof(s->key[0]));
+			memmove(&s->val[0], &s->val[1], s->n * sizeof(s->val[0]));
+			p->key[i] = s->key[0];
+			p->val[i] = s->val[0];
+			return;
+		}
+		/* Merge the right one of the pair into the left. */
+		if (i > 0)
+			i--;
+		c = p->child[i];
+		s = p->child[i + 1];
+		memcpy(&c->key[c->n], s->key, s->n * sizeof(s->key[0]));
+		memcpy(&c->val[c->n], s->val, s->n * sizeof(s->val[0]));
+		c->n += s->n;
+		c->next = s->next;
+		free(s);
+	} else {
+		struct btree_inner *c = p->child[i], *s;
+
+		if (i > 0 && (s = p->child[i - 1])->n > INNER_MIN) {
+			memmove(&c->key[1], &c->key[0], c->n * sizeof(c->key[0]));
+			memmove(&c->val[1], &c->val[0], c->n * sizeof(c->val[0]));
+			memmove(&c->child[1], &c->child[0], (c->n + 1) * sizeof(c->child[0]));
+			c->key[0] = p->key[i - 1];
+			c->val[0] = p->val[i - 1];
+			c->child[0] = s->child[s->n];
+			c->n++;
+			p->key[i - 1] = s->key[s->n - 1];
+			p->val[i - 1] = s->val[s->n - 1];
+			s->n--;
+			return;
+		}
+		if (i < p->n && (s = p->child[i + 1])->n > INNER_MIN) {
+			c->key[c->n] = p->key[i];
+			c->val[c->n] = p->val[i];
+			c->child[c->n + 1] = s->child[0];
+			c->n++;
+			p->key[i] = s->key[0];
+			p->val[i] = s->val[0];
+			s->n--;
+			memmove(&s->key[0], &s->key[1], s->n * sizeof(s->key[0]));
+			memmove(&s->val[0], &s->val[1], s->n * sizeof(s->val[0]));
+			memmove(&s->child[0], &s->child[1], (s->n + 1) * sizeof(s->child[0]));
+			return;
+		}
+		if (i > 0)
+			i--;
+		c = p->child[i];
+		s = p->child[i + 1];
+		c->key[c->n] = p->key[i];
+		c->val[c->n] = p->val[i];
+		memcpy(&c->key[c->n + 1], s->key, s->n * sizeof(s->key[0]));
+		memcpy(&c->val[c->n + 1], s->val, s->n * sizeof(s->val[0]));
+		memcpy(&c->child[c->n + 1], s->child, (s->n + 1) * sizeof(s->child[0]));
+		c->n += s->n + 1;
+		free(s);
+	}
+	/* Separator i and child i + 1 are gone. */
+	p->n--;
+	memmove(&p->key[i], &p->key[i + 1], (p->n - i) * sizeof(p->key[0]));
+	memmove(&p->val[i], &p->val[i + 1], (p->n - i) * sizeof(p->val[0]));
+	memmove(&p->child[i + 1], &p->child[i + 2], (p->n - i) * sizeof(p->child[0]));
+}
+
+/*
+ * Delete from the subtree n of height h. Returns 1 if something was
+ * deleted, the caller checks if n got too small.
+ */
+static int
+bt_delete(void *n, int h, int64_t k, void *v)
+{
+	struct btree_inner *in;
+	struct btree_leaf *l;
+	int i;
+
+	if (h == 1) {
+		l = n;
+		i = leaf_pos(l, k, v);
+		if (i == l->n || l->key[i] != k || l->val[i] != v)
+			return 0;
+		l->n--;
+		memmove(&l->key[i], &l->key[i + 1], (l->n - i) * sizeof(l->key[0]));
+		memmove(&l->val[i], &l->val[i + 1], (l->n - i) * sizeof(l->val[0]));
+		return 1;
+	}
+
+	in = n;
+	i = inner_pos(in, k, v);
+	if (!bt_delete(in->child[i], h - 1, k, v))
+		return 0;
+	if (bt_n(in->child[i]) < (h == 2 ? LEAF_MIN : INNER_MIN))
+		bt_fix(in, i, h - 1);
+	return 1;
+}
+
+int
+btree_delete(struct btree *t, int64_t k, void *v)
+{
+	struct btree_inner *in;
+
+	if (t->root == NULL || !bt_delete(t->root, t->height, k, v))
+		return 0;
+	t->count--;
+	if (t->height > 1) {
+		in = t->root;
+		if (in->n == 0) {
+			t->root = in->child[0];
+			t->height--;
+			free(in);
+		}
+	} else if (t->first->n == 0) {
+		free(t->root);
+		btree_init(t);
+	}
+	return 1;
+}
+
+/*
+ * Return the value of the first entry with key k.
+ */
+void *
+btree_lookup(const struct btree *t, int64_t k)
+{
+	int64_t fk;
+	void *v;
+
+	if ((v = btree_search(t, k, &fk)) != NULL && fk == k)
+		return v;
+	return NULL;
+}
+
+/*
+ * Return the best greater or equal match, its key in *kp.
+ */
+void *
+btree_search(const struct btree *t, int64_t k, int64_t *kp)
+{
+	struct btree_leaf *l;
+	int i;
+
+	if (t->root == NULL)
+		return NULL;
+	l = bt_leaf(t, k, NULL);
+	if ((i = leaf_pos(l, k, NULL)) == l->n) {
+		/* Everything here is below, it's the first one in the next. */
+		if ((l = l->next) == NULL)
+			return NULL;
+		i = 0;
+	}
+	if (kp != NULL)
+		*kp = l->key[i];
+	return l->val[i];
+}
+
+void *
+btree_first(const struct btree *t, int64_t *kp)
+{
+	if (t->first == NULL)
+		return NULL;
+	if (kp != NULL)
+		*kp = t->first->key[0];
+	return t->first->val[0];
+}
+
+/*
+ * Check the subtree n of height h, everything must be in [lo, hi).
+ * Returns the number of entries and moves *leaf along the leaf list.
+ */
+static long
+bt_check(void *n, int h, int root, const int64_t *lok, void *lov,
+    const int64_t *hik, void *hiv, struct btree_leaf **leaf)
+{
+	struct btree_inner *in = n;
+	struct btree_leaf *l = n;
+	long count = 0;
+	int i;
+
+	if (h == 1) {
+		assert(l == *leaf);
+		assert(l->n <= LEAF_MAX && (root || l->n >= LEAF_MIN));
+		for (i = 0; i < l->n; i++) {
+			if (i > 0)
+				assert(bt_lt(l->key[i - 1], l->val[i - 1], l->key[i], l->val[i]));
+			assert(lok == NULL || !bt_lt(l->key[i], l->val[i], *lok, lov));
+			assert(hik == NULL || bt_lt(l->key[i], l->val[i], *hik, hiv));
+		}
+		*leaf = l->next;
+		return l->n;
+	}
+	assert(in->n <= INNER_MAX && (root ? in->n >= 1 : in->n >= INNER_MIN));
+	for (i = 0; i <= in->n; i++) {
+		if (i > 0 && i < in->n)
+			assert(bt_lt(in->key[i - 1], in->val[i - 1], in->key[i], in->val[i]));
+		count += bt_check(in->child[i], h - 1, 0,
+		    i == 0 ? lok : &in->key[i - 1], i == 0 ? lov : in->val[i - 1],
+		    i == in->n ? hik : &in->key[i], i == in->n ? hiv : in->val[i],
+		    leaf);
+	}
+	return count;
+}
+
+void
+btree_check(const struct btree *t)
+{
+	struct btree_leaf *leaf = t->first;
+
+	if (t->root == NULL) {
+		assert(t->height == 0 && t->count == 0 && t->first == NULL);
+		return;
+	}
+	assert(bt_check(t->root, t->height, 1, NULL, NULL, NULL, NULL, &leaf) == t->count);
+	assert(leaf == NULL);
+}
+
+static size_t
+bt_memsize(void *n, int h)
+{
+	struct btree_inner *in = n;
+	size_t sz;
+	int i;
+
+	if (h == 1)
+		return sizeof(struct btree_leaf);
+	sz = sizeof(*in);
+	for (i = 0; i <= in->n; i++)
+		sz += bt_memsize(in->child[i], h - 1);
+	return sz;
+}
+
+/*
+ * Bytes allocated for the tree nodes.
+ */
+size_t
+btree_memsize(const struct btree *t)
+{
+	return t->root == NULL ? 0 : bt_memsize(t->root, t->height);
+}
+
+void
+btree_it_init(struct btree_it *it, const struct btree *t, const int64_t *s,
+    const int64_t *e)
+{
+	btree_it_init2(it, t, s, e, 0);
+}
+
+/*
+ * Iterate from the first entry with key s or above to the last entry
+ * below e, or equal to e if ince. NULL s or e is from the start or to
+ * the end.
+ */
+void
+btree_it_init2(struct btree_it *it, const struct btree *t, const int64_t *s,
+    const int64_t *e, int ince)
+{
+	memset(it, 0, sizeof(*it));
+	if (t->root == NULL)
+		return;
+	if (s == NULL) {
+		it->l = t->first;
+	} else {
+		it->l = bt_leaf(t, *s, NULL);
+		it->i = leaf_pos(it->l, *s, NULL);
+	}
+	if (e != NULL) {
+		it->has_e = 1;
+		it->e = *e;
+		it->ince = ince;
+	}
+}
+
+void *
+btree_it_next(struct btree_it *it, int64_t *kp)
+{
+	struct btree_leaf *l;
+	int64_t k;
+
+	while ((l = it->l) != NULL && it->i == l->n) {
+		it->l = l->next;
+		it->i = 0;
+	}
+	if (l == NULL)
+		return NULL;
+	k = l->key[it->i];
+	if (it->has_e && (it->ince ? k > it->e : k >= it->e)) {
+		it->l = NULL;
+		return NULL;
+	}
+	if (kp != NULL)
+		*kp = k;
+	return l->val[it->i++];
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "arena.h"
+
+#define HUGE_PAGE	(2UL * 1024 * 1024)
+
+static int
+arena_bind(void *p, size_t len, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	unsigned long mask[16];
+
+	if (node < 0 || node >= sizeof(mask) * 8) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(mask, 0, sizeof(mask));
+	mask[node / (sizeof(mask[0]) * 8)] = 1UL << (node % (sizeof(mask[0]) * 8));
+	return syscall(SYS_mbind, p, len, MPOL_BIND, mask, sizeof(mask) * 8, 0);
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+int
+arena_init(struct arena *a, size_t nslots, size_t size, int flags, int node)
+{
+	size_t len = nslots * size;
+	int mflags = MAP_PRIVATE | MAP_ANON;
+	char *p;
+
+	memset(a, 0, sizeof(*a));
+	if (len == 0)
+		len = 1;
+	if (flags & (ARENA_THP|ARENA_HUGETLB))
+		len = (len + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+	/* Room to align the transparent ones. */
+	a->a_maplen = len + (flags & ARENA_THP ? HUGE_PAGE : 0);
+	if (flags & ARENA_HUGETLB) {
+#ifdef MAP_HUGETLB
+		mflags |= MAP_HUGETLB;
+#else
+		errno = EOPNOTSUPP;
+		return -1;
+#endif
+	}
+	if ((a->a_map = mmap(NULL, a->a_maplen, PROT_READ|PROT_WRITE, mflags,
+	    -1, 0)) == MAP_FAILED)
+		return -1;
+	p = a->a_map;
+	if (flags & ARENA_THP) {
+		p = (char *)(((uintptr_t)p + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+#ifdef MADV_HUGEPAGE
+		if (madvise(p, len, MADV_HUGEPAGE) == -1)
+			goto fail;
+#endif
+	}
+	/* Before anything is touched, the pages come from the node. */
+	if (node >= 0 && arena_bind(p, len, node) == -1)
+		goto fail;
+	a->a_base = p;
+	a->a_size = size;
+	a->a_nslots = nslots;
+	return 0;
+fail:
+	munmap(a->a_map, a->a_maplen);
+	a->a_map = NULL;
+	return -1;
+}
+
+/*
+ * Fisher-Yates with splitmix64, the arena shouldn't touch anyone
+ * else's random numbers.
+ */
+void
+arena_shuffle(struct arena *a, uint64_t seed)
+{
+	uint64_t z;
+	size_t i, j;
+	uint32_t t;
+
+	if (a->a_order == NULL &&
+	    (a->a_order = malloc(a->a_nslots * sizeof(*a->a_order))) == NULL)
+		return;
+	for (i = 0; i < a->a_nslots; i++)
+		a->a_order[i] = i;
+	for (i = a->a_nslots; i > 1; i--) {
+		z = (seed += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		z ^= z >> 31;
+		j = z % i;
+		t = a->a_order[i - 1];
+		a->a_order[i - 1] = a->a_order[j];
+		a->a_order[j] = t;
+	}
+}
+
+void
+arena_fini(struct arena *a)
+{
+	if (a->a_map != NULL)
+		munmap(a->a_map, a->a_maplen);
+	free(a->a_order);
+	memset(a, 0, sizeof(*a));
+}
+
+int
+arena_parse(const char *opts, int *flags, int *node)
+{
+	char *o, *p, *w, *e;
+	int ret = 0;
+
+	if ((o = strdup(opts)) == NULL)
+		return -1;
+	for (p = o; (w = strsep(&p, ",")) != NULL;) {
+		if (!strcmp(w, "thp")) {
+			*flags |= ARENA_THP;
+		} else if (!strcmp(w, "hugetlb")) {
+			*flags |= ARENA_HUGETLB;
+		} else if (!strcmp(w, "shuffle")) {
+			*flags |= ARENA_SHUFFLE;
+		} else if (!strncmp(w, "node=", 5)) {
+			*node = strtol(w + 5, &e, 10);
+			if (*e != '\0' || *node < 0)
+				ret = -1;
+		} else if (*w != '\0') {
+			ret = -1;
+		}
+	}
+	free(o);
+	if (ret == -1)
+		errno = EINVAL;
+	return ret;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed size slots for heap elements in one mapping. The elements of a
+ * big heap are spread over so many pages that the heap walk misses in
+ * the TLB as much as in the cache, the arena can use huge pages and
+ * keep the memory on one NUMA node.
+ *
+ *  ARENA_THP		ask for transparent huge pages, the mapping is
+ *			2MB aligned.
+ *  ARENA_HUGETLB	explicit huge pages, fails unless there are
+ *			enough of them reserved.
+ *
+ * node is the NUMA node to bind the memory to, -1 for any.
+ *
+ * arena_alloc hands out the slots in address order, or in random order
+ * after arena_shuffle, which is what the slots of a heap that has been
+ * running for a while look like. arena_slot(a, i) is what the i:th
+ * arena_alloc returns. The memory is zeroed. The slots are one array
+ * starting at a_base, IHEAP can index it.
+ *
+ * arena_parse takes "thp", "hugetlb", "shuffle" and "node=N" separated
+ * by commas, for command lines.
+ */
+
+#define ARENA_THP	0x01
+#define ARENA_HUGETLB	0x02
+#define ARENA_SHUFFLE	0x04	/* only for arena_parse */
+
+struct arena {
+	char *a_base;
+	size_t a_size;		/* slot size */
+	size_t a_nslots;
+	size_t a_next;
+	size_t a_maplen;
+	void *a_map;
+	uint32_t *a_order;	/* after arena_shuffle */
+};
+
+int arena_init(struct arena *, size_t, size_t, int, int);
+void arena_shuffle(struct arena *, uint64_t);
+void arena_fini(struct arena *);
+int arena_parse(const char *, int *, int *);
+
+static inline void *
+arena_slot(struct arena *a, size_t i)
+{
+	if (a->a_order != NULL)
+		i = a->a_order[i];
+	return a->a_base + i * a->a_size;
+}
+
+static inline void *
+arena_alloc(struct arena *a)
+{
+	if (a->a_next == a->a_nslots)
+		return NULL;
+	return arena_slot(a, a->a_next++);
+}
+
+#endif /*ARENA_H*/
@@ -20,7 +20,23 @@
 /*
  * HEAP implements INSERT, REMOVE_HEAD, UPDATE_HEAD.
  * PHEAP implements INSERT, REMOVE, UPDATE
+ * CHEAP implements INSERT, REMOVE, UPDATE, INCREASE_KEY, DECREASE_KEY
+ * IHEAP is CHEAP with 32 bit indices into an array of elements.
+ * AHEAP implements INSERT, REMOVE, UPDATE in an array instead of links.
+ * DHEAP is AHEAP with a configurable number of children per node.
+ * KDHEAP is DHEAP for integer keys, optionally using SIMD.
+ * RHEAP is a radix heap for monotone unsigned keys with the same interface.
+ *
+ * They all have CHECK, which asserts that the heap is consistent. It
+ * walks the whole heap, it's for tests.
  */
+#include <assert.h>
+
+/* For generated functions that not every user calls. */
+#ifndef HEAP_UNUSED
+#define HEAP_UNUSED __attribute__((__unused__))
+#endif
+
 #define HEAP_HEAD(name, type) 						\
 struct name {								\
 	type *hh_root;							\
@@ -48,11 +64,15 @@ struct name {								\
 #define HEAP_INSERT(name, head, item) name##_HEAP_INSERT(head, item)
 #define HEAP_REMOVE_HEAD(name, head) name##_HEAP_REMOVE_HEAD(head)
 #define HEAP_UPDATE_HEAD(name, head) name##_HEAP_UPDATE_HEAD(head)
+#define HEAP_BUILD(name, head, array, n) name##_HEAP_BUILD(head, array, n)
+#define HEAP_CHECK(name, head) name##_HEAP_CHECK(head)
 
 #define HEAP_PROTOTYPE(name, type, field, cmp, funprefix)		\
 funprefix void	name##_HEAP_INSERT(struct name *, type *);		\
 funprefix void	name##_HEAP_REMOVE_HEAD(struct name *);			\
-funprefix void	name##_HEAP_UPDATE_HEAD(struct name *);
+funprefix void	name##_HEAP_UPDATE_HEAD(struct name *);			\
+funprefix void	name##_HEAP_BUILD(struct name *, type **, unsigned long);\
+funprefix void	name##_HEAP_CHECK(struct name *);
 
 /*
  * The HEAP is organized as a binary tree, with all levels filled except the last.
@@ -84,12 +104,19 @@ funprefix void	name##_HEAP_UPDATE_HEAD(struct name *);
  *
  * Head removal is done by moving the last element of the heap into the head
  * and then as a head update.
+ *
+ * BUILD throws away whatever is in the heap and builds a new heap out of
+ * an array of n elements bottom up (Floyd), which is O(n) instead of the
+ * O(n log n) of n inserts. The positions above have their children at
+ * p + 2^k and p + 2^(k+1) where k is the depth of p, so the tree is
+ * built by recursing over positions, each subtree is heapified before
+ * its root is pushed down into it.
  */
 
 #define HEAP_GENERATE(name, type, field, cmp, funprefix)		\
 									\
 funprefix void								\
-name##_HEAP_INSERT(struct name __restrict *head, type __restrict *el)	\
+name##_HEAP_INSERT(struct name *__restrict head, type *__restrict el)	\
 {									\
 	type **lp;							\
 	int n;								\
@@ -125,14 +152,9 @@ name##_HEAP_REMOVE_HEAD(struct name *head)				\
 }									\
 									\
 funprefix void								\
-name##_HEAP_UPDATE_HEAD(struct name *head)				\
+name##_HEAP_DOWN(type **lp)						\
 {									\
-	type **lp;							\
-									\
-	if (head->hh_root == NULL)					\
-		return;							\
-									\
-	for (lp = &head->hh_root; (*lp)->field.he_link[1] != NULL;) {	\
+	for (; (*lp)->field.he_link[1] != NULL;) {			\
 		type *link[2];						\
 		int c;							\
 		link[0] = (*lp)->field.he_link[0];			\
@@ -146,6 +168,69 @@ name##_HEAP_UPDATE_HEAD(struct name *head)				\
 		*lp = link[!c];						\
 		lp = &(*lp)->field.he_link[!c];				\
 	}								\
+}									\
+									\
+funprefix void								\
+name##_HEAP_UPDATE_HEAD(struct name *head)				\
+{									\
+	if (head->hh_root == NULL)					\
+		return;							\
+	name##_HEAP_DOWN(&head->hh_root);				\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_HEAPIFY(type **lp, unsigned long p, unsigned long k,	\
+    type **items, unsigned long n)					\
+{									\
+	type *el = items[p - 1];					\
+	unsigned long c;						\
+									\
+	el->field.he_link[0] = el->field.he_link[1] = NULL;		\
+	*lp = el;							\
+	if ((c = p + (1UL << k)) <= n) {				\
+		name##_HEAP_HEAPIFY(&el->field.he_link[1], c, k + 1, items, n);\
+		if ((c += 1UL << k) <= n)				\
+			name##_HEAP_HEAPIFY(&el->field.he_link[0], c, k + 1,\
+			    items, n);					\
+	}								\
+	name##_HEAP_DOWN(lp);						\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_BUILD(struct name *head, type **items, unsigned long n)	\
+{									\
+	head->hh_root = NULL;						\
+	head->hh_num = n;						\
+	if (n > 0)							\
+		name##_HEAP_HEAPIFY(&head->hh_root, 1, 0, items, n);	\
+}									\
+									\
+/*									\
+ * Check the heap order and that the tree has the shape hh_num says it	\
+ * has. The children of p at depth k are at p + 2^k and p + 2^(k+1).	\
+ */									\
+HEAP_UNUSED funprefix unsigned long					\
+name##_HEAP_CHECK_SUB(type *el, type *parent, unsigned long p,		\
+    unsigned long k, unsigned long num)					\
+{									\
+	if (p > num) {							\
+		assert(el == NULL);					\
+		return 0;						\
+	}								\
+	assert(el != NULL);						\
+	assert(parent == NULL || cmp(parent, el) <= 0);			\
+	return 1 +							\
+	    name##_HEAP_CHECK_SUB(el->field.he_link[1], el, p + (1UL << k),\
+	    k + 1, num) +						\
+	    name##_HEAP_CHECK_SUB(el->field.he_link[0], el, p + (2UL << k),\
+	    k + 1, num);						\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_CHECK(struct name *head)					\
+{									\
+	assert(name##_HEAP_CHECK_SUB(head->hh_root, NULL, 1, 0,		\
+	    head->hh_num) == (unsigned long)head->hh_num);		\
 }
 
 #define PHEAP_HEAD(name, type) HEAP_HEAD(name, type)
@@ -165,13 +250,13 @@ name##_HEAP_UPDATE_HEAD(struct name *head)				\
 #define PHEAP_UPDATE(name, head, item) name##_HEAP_UPDATE(head, item)
 #define PHEAP_REMOVE_HEAD(name, head) name##_HEAP_REMOVE(head, PHEAP_FIRST(head))
 #define PHEAP_UPDATE_HEAD(name, head) name##_HEAP_UPDATE(head, PHEAP_FIRST(head))
+#define PHEAP_CHECK(name, head) name##_HEAP_CHECK(head)
 
 #define PHEAP_PROTOTYPE(name, type, field, cmp, funprefix)		\
 funprefix void name##_HEAP_INSERT(struct name *, type *);		\
 funprefix void name##_HEAP_REMOVE(struct name *, type *);		\
-funprefix void name##_HEAP_UPDATE(struct name *, type *);
-
-#include <assert.h>
+funprefix void name##_HEAP_UPDATE(struct name *, type *);		\
+funprefix void name##_HEAP_CHECK(struct name *);
 
 #define PHEAP_GENERATE(name, type, field, cmp, funprefix)		\
 funprefix void								\
@@ -268,6 +353,35 @@ name##_HEAP_UPDATE(struct name *head, type *el)				\
 			break;						\
 		name##_HEAP_SWAP(head,el->field.he_link[lower]);	\
 	}								\
+}									\
+									\
+/*									\
+ * Like HEAP_CHECK, but link 0 is filled first and the parent pointers	\
+ * must be right.							\
+ */									\
+HEAP_UNUSED funprefix unsigned long					\
+name##_HEAP_CHECK_SUB(type *el, type *parent, unsigned long p,		\
+    unsigned long k, unsigned long num)					\
+{									\
+	if (p > num) {							\
+		assert(el == NULL);					\
+		return 0;						\
+	}								\
+	assert(el != NULL);						\
+	assert(el->field.he_parent == parent);				\
+	assert(parent == NULL || cmp(parent, el) <= 0);			\
+	return 1 +							\
+	    name##_HEAP_CHECK_SUB(el->field.he_link[0], el, p + (1UL << k),\
+	    k + 1, num) +						\
+	    name##_HEAP_CHECK_SUB(el->field.he_link[1], el, p + (2UL << k),\
+	    k + 1, num);						\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_CHECK(struct name *head)					\
+{									\
+	assert(name##_HEAP_CHECK_SUB(head->hh_root, NULL, 1, 0,		\
+	    head->hh_num) == (unsigned long)head->hh_num);		\
 }
 
 #define CHEAP_HEAD(name, type) HEAP_HEAD(name, type)
@@ -287,15 +401,27 @@ name##_HEAP_UPDATE(struct name *head, type *el)				\
 #define CHEAP_UPDATE(name, head, item) name##_HEAP_UPDATE(head, item, item)
 #define CHEAP_REMOVE_HEAD(name, head) name##_HEAP_REMOVE(head, CHEAP_FIRST(head))
 #define CHEAP_UPDATE_HEAD(name, head) name##_HEAP_UPDATE(head, CHEAP_FIRST(head), CHEAP_FIRST(head))
+#define CHEAP_DECREASE_KEY(name, head, item) name##_HEAP_DECREASE_KEY(head, item)
+#define CHEAP_INCREASE_KEY(name, head, item) name##_HEAP_INCREASE_KEY(head, item)
+#define CHEAP_INSERT_BATCH(name, head, items, n) name##_HEAP_INSERT_BATCH(head, items, n)
+#define CHEAP_BUILD(name, head, items, n) name##_HEAP_BUILD(head, items, n)
+#define CHEAP_CHECK(name, head) name##_HEAP_CHECK(head)
 
 #define CHEAP_PROTOTYPE(name, type, field, cmp, funprefix)		\
 funprefix void name##_HEAP_INSERT(struct name *, type *);		\
 funprefix void name##_HEAP_REMOVE(struct name *, type *);		\
-funprefix void name##_HEAP_UPDATE(struct name *, type *, type*);
+funprefix void name##_HEAP_UPDATE(struct name *, type *, type*);	\
+funprefix type **name##_HEAP_UP(struct name *, type *, type *);	\
+funprefix void name##_HEAP_DOWN(type **);				\
+funprefix void name##_HEAP_DECREASE_KEY(struct name *, type *);		\
+funprefix void name##_HEAP_INCREASE_KEY(struct name *, type *);		\
+funprefix void name##_HEAP_INSERT_BATCH(struct name *, type **, unsigned long);\
+funprefix void name##_HEAP_BUILD(struct name *, type **, unsigned long);\
+funprefix void name##_HEAP_CHECK(struct name *);
 
 #define CHEAP_GENERATE(name, type, field, cmp, funprefix)		\
 funprefix void								\
-name##_HEAP_INSERT(struct name __restrict *head, type __restrict *el)	\
+name##_HEAP_INSERT(struct name *__restrict head, type *__restrict el)	\
 {									\
 	type **lp;							\
 	int n;								\
@@ -322,7 +448,7 @@ name##_HEAP_INSERT(struct name __restrict *head, type __restrict *el)	\
 	el->field.he_pos = head->hh_num;				\
 }									\
 funprefix void								\
-name##_HEAP_REMOVE(struct name *head, type __restrict *el)		\
+name##_HEAP_REMOVE(struct name *head, type *__restrict el)		\
 {									\
 	type **lp, *rep;						\
 	unsigned int n;							\
@@ -337,10 +463,12 @@ name##_HEAP_REMOVE(struct name *head, type __restrict *el)		\
 }									\
 									\
 /*									\
- * Update the element pos with the element el.				\
+ * Put the element el in the position of pos, moving it up towards	\
+ * the root if needed. Returns where the element that ended up in the	\
+ * position of pos is.							\
  */									\
-funprefix void								\
-name##_HEAP_UPDATE(struct name *head, type *pos, type *el)		\
+funprefix type **							\
+name##_HEAP_UP(struct name *head, type *pos, type *el)			\
 {									\
 	type **lp;							\
 	type *l0, *l1;							\
@@ -362,12 +490,60 @@ name##_HEAP_UPDATE(struct name *head, type *pos, type *el)		\
 	el->field.he_link[1] = l1;					\
 	el->field.he_pos = p;						\
 	*lp = el;							\
+	return lp;							\
+}									\
+									\
+/*									\
+ * Update the element pos with the element el.				\
+ */									\
+funprefix void								\
+name##_HEAP_UPDATE(struct name *head, type *pos, type *el)		\
+{									\
 	/*								\
 	 * Now look if we need to push it down.				\
 	 *								\
 	 * Even when the element has been propagated up, it can		\
 	 * still break the heap invariant on the last element.		\
-	 *								\
+	 */								\
+	name##_HEAP_DOWN(name##_HEAP_UP(head, pos, el));		\
+}									\
+									\
+/*									\
+ * The key of el got smaller, it can only move up. Whatever ends up in	\
+ * its old position was above it, so there's no need to look down.	\
+ */									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_DECREASE_KEY(struct name *head, type *el)			\
+{									\
+	name##_HEAP_UP(head, el, el);					\
+}									\
+									\
+/*									\
+ * The key of el got bigger, it can only move down. Find it without	\
+ * comparing anything on the way.					\
+ */									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_INCREASE_KEY(struct name *head, type *el)			\
+{									\
+	type **lp = &head->hh_root;					\
+	unsigned long n;						\
+									\
+	for (n = el->field.he_pos; n > 1; n >>= 1)			\
+		lp = &(*lp)->field.he_link[n & 1];			\
+	name##_HEAP_DOWN(lp);						\
+}									\
+									\
+/*									\
+ * Push the element at *lp down until the heap invariant holds.		\
+ */									\
+funprefix void								\
+name##_HEAP_DOWN(type **lp)						\
+{									\
+	type *el = *lp;							\
+	type *l0;							\
+	unsigned long p;						\
+									\
+	/*								\
 	 * 0 gets filled in before 1					\
 	 */								\
 	while (el->field.he_link[0] != NULL) {				\
@@ -387,8 +563,1048 @@ name##_HEAP_UPDATE(struct name *head, type *pos, type *el)		\
 		l->field.he_pos = p;					\
 		lp = &l->field.he_link[lower];				\
 	}								\
+}									\
+									\
+/*									\
+ * Heapify the subtree at position p and depth k. Positions after old	\
+ * are empty and get filled from items.					\
+ */									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_HEAPIFY(struct name *head, type **lp, unsigned long p,	\
+    unsigned long k, unsigned long old, type **items)			\
+{									\
+	type *el;							\
+	unsigned long c;						\
+									\
+	if (p > old) {							\
+		el = items[p - old - 1];				\
+		el->field.he_link[0] = el->field.he_link[1] = NULL;	\
+		el->field.he_pos = p;					\
+		*lp = el;						\
+	} else								\
+		el = *lp;						\
+	if ((c = p + (1UL << k)) <= head->hh_num) {			\
+		name##_HEAP_HEAPIFY(head, &el->field.he_link[0], c, k + 1,\
+		    old, items);					\
+		if ((c += 1UL << k) <= head->hh_num)			\
+			name##_HEAP_HEAPIFY(head, &el->field.he_link[1], c,\
+			    k + 1, old, items);				\
+	}								\
+	name##_HEAP_DOWN(lp);						\
+}									\
+									\
+/*									\
+ * Add n elements at once. When the batch is small compared to the	\
+ * heap it's cheaper to insert them one by one, otherwise the new	\
+ * elements are put in the empty positions at the end of the heap and	\
+ * the whole heap is heapified bottom up in O(n + hh_num).		\
+ */									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_INSERT_BATCH(struct name *head, type **items, unsigned long n)\
+{									\
+	unsigned long old = head->hh_num;				\
+	unsigned long i, l;						\
+									\
+	for (l = 0, i = old; i > 1; i >>= 1)				\
+		l++;							\
+	if (n * l < old) {						\
+		for (i = 0; i < n; i++)					\
+			name##_HEAP_INSERT(head, items[i]);		\
+		return;							\
+	}								\
+	if ((head->hh_num += n) == 0)					\
+		return;							\
+	name##_HEAP_HEAPIFY(head, &head->hh_root, 1, 0, old, items);	\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_BUILD(struct name *head, type **items, unsigned long n)	\
+{									\
+	CHEAP_INIT(head);						\
+	name##_HEAP_INSERT_BATCH(head, items, n);			\
+}									\
+									\
+/*									\
+ * Like the PHEAP check, every element must know its position.		\
+ */									\
+HEAP_UNUSED funprefix unsigned long					\
+name##_HEAP_CHECK_SUB(type *el, type *parent, unsigned long p,		\
+    unsigned long k, unsigned long num)					\
+{									\
+	if (p > num) {							\
+		assert(el == NULL);					\
+		return 0;						\
+	}								\
+	assert(el != NULL);						\
+	assert(el->field.he_pos == p);					\
+	assert(parent == NULL || cmp(parent, el) <= 0);			\
+	return 1 +							\
+	    name##_HEAP_CHECK_SUB(el->field.he_link[0], el, p + (1UL << k),\
+	    k + 1, num) +						\
+	    name##_HEAP_CHECK_SUB(el->field.he_link[1], el, p + (2UL << k),\
+	    k + 1, num);						\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_CHECK(struct name *head)					\
+{									\
+	assert(name##_HEAP_CHECK_SUB(head->hh_root, NULL, 1, 0,		\
+	    head->hh_num) == (unsigned long)head->hh_num);		\
+}
+
+
+/*
+ * IHEAP is a CHEAP for elements that all live in one array. The links
+ * are 32 bit indices into the array instead of pointers, so the entry
+ * is 12 bytes instead of 24. Index 0 is the NULL link, element i in
+ * the array is index i + 1. The array is given to IHEAP_INIT and can't
+ * have more than 2^32 - 1 elements.
+ */
+#include <stdint.h>
+
+#define IHEAP_HEAD(name, type)						\
+struct name {								\
+	type *hh_base;							\
+	uint32_t hh_root;						\
+	uint32_t hh_num;						\
+}
+#define IHEAP_ENTRY(type)						\
+	struct {							\
+		uint32_t he_link[2];					\
+		uint32_t he_pos;					\
+	}
+#define IHEAP_ENTRY_INITIALIZER { { 0, 0 }, 0 }
+#define IHEAP_INIT(head, base) do {					\
+	(head)->hh_base = (base);					\
+	(head)->hh_root = 0;						\
+	(head)->hh_num = 0;						\
+} while (0)
+#define IHEAP_EL(head, i) (&(head)->hh_base[(i) - 1])
+#define IHEAP_IDX(head, el) ((uint32_t)((el) - (head)->hh_base) + 1)
+#define IHEAP_FIRST(head) ((head)->hh_root ? IHEAP_EL(head, (head)->hh_root) : NULL)
+#define IHEAP_EMPTY(head) ((head)->hh_root == 0)
+#define IHEAP_INSERT(name, head, item) name##_HEAP_INSERT(head, item)
+#define IHEAP_REMOVE(name, head, item) name##_HEAP_REMOVE(head, item)
+#define IHEAP_UPDATE(name, head, item) name##_HEAP_UPDATE(head, item, item)
+#define IHEAP_REMOVE_HEAD(name, head) name##_HEAP_REMOVE(head, IHEAP_FIRST(head))
+#define IHEAP_UPDATE_HEAD(name, head) name##_HEAP_UPDATE(head, IHEAP_FIRST(head), IHEAP_FIRST(head))
+#define IHEAP_DECREASE_KEY(name, head, item) name##_HEAP_DECREASE_KEY(head, item)
+#define IHEAP_INCREASE_KEY(name, head, item) name##_HEAP_INCREASE_KEY(head, item)
+#define IHEAP_CHECK(name, head) name##_HEAP_CHECK(head)
+
+#define IHEAP_PROTOTYPE(name, type, field, cmp, funprefix)		\
+funprefix void name##_HEAP_INSERT(struct name *, type *);		\
+funprefix void name##_HEAP_REMOVE(struct name *, type *);		\
+funprefix void name##_HEAP_UPDATE(struct name *, type *, type *);	\
+funprefix uint32_t *name##_HEAP_UP(struct name *, type *, type *);	\
+funprefix void name##_HEAP_DOWN(struct name *, uint32_t *);		\
+funprefix void name##_HEAP_DECREASE_KEY(struct name *, type *);		\
+funprefix void name##_HEAP_INCREASE_KEY(struct name *, type *);		\
+funprefix void name##_HEAP_CHECK(struct name *);
+
+/*
+ * Same algorithms as CHEAP, lp points to the index of the element
+ * instead of the pointer to it.
+ */
+#define IHEAP_GENERATE(name, type, field, cmp, funprefix)		\
+funprefix void								\
+name##_HEAP_INSERT(struct name *__restrict head, type *__restrict el)	\
+{									\
+	uint32_t *lp, e = IHEAP_IDX(head, el);				\
+	uint32_t n;							\
+									\
+	lp = &head->hh_root;						\
+	for (n = ++head->hh_num; n > 1; n >>= 1) {			\
+		type *t = IHEAP_EL(head, *lp);				\
+		if (cmp(el, t) < 0) {					\
+			el->field = t->field;				\
+			*lp = e;					\
+			el = t;						\
+			e = IHEAP_IDX(head, t);				\
+		}							\
+		lp = &IHEAP_EL(head, *lp)->field.he_link[n & 1];	\
+	}								\
+	*lp = e;							\
+	el->field.he_link[0] = el->field.he_link[1] = 0;		\
+	el->field.he_pos = head->hh_num;				\
+}									\
+									\
+funprefix void								\
+name##_HEAP_REMOVE(struct name *head, type *__restrict el)		\
+{									\
+	uint32_t *lp;							\
+	type *rep;							\
+	uint32_t n;							\
+									\
+	for (n = head->hh_num, lp = &head->hh_root; n > 1; n >>= 1)	\
+		lp = &IHEAP_EL(head, *lp)->field.he_link[n & 1];	\
+	head->hh_num--;							\
+	rep = IHEAP_EL(head, *lp);					\
+	*lp = 0;							\
+	if (rep == el)							\
+		return;							\
+	name##_HEAP_UPDATE(head, el, rep);				\
+}									\
+									\
+funprefix uint32_t *							\
+name##_HEAP_UP(struct name *head, type *pos, type *el)			\
+{									\
+	uint32_t *lp, e = IHEAP_IDX(head, el);				\
+	uint32_t l0, l1;						\
+	uint32_t p = pos->field.he_pos;					\
+	uint32_t n;							\
+									\
+	l0 = pos->field.he_link[0];					\
+	l1 = pos->field.he_link[1];					\
+	lp = &head->hh_root;						\
+	for (n = p; n > 1; n >>= 1) {					\
+		type *t = IHEAP_EL(head, *lp);				\
+		if (cmp(el, t) < 0) {					\
+			el->field = t->field;				\
+			*lp = e;					\
+			el = t;						\
+			e = IHEAP_IDX(head, t);				\
+		}							\
+		lp = &IHEAP_EL(head, *lp)->field.he_link[n & 1];	\
+	}								\
+	el->field.he_link[0] = l0;					\
+	el->field.he_link[1] = l1;					\
+	el->field.he_pos = p;						\
+	*lp = e;							\
+	return lp;							\
+}									\
+									\
+funprefix void								\
+name##_HEAP_UPDATE(struct name *head, type *pos, type *el)		\
+{									\
+	name##_HEAP_DOWN(head, name##_HEAP_UP(head, pos, el));		\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_DECREASE_KEY(struct name *head, type *el)			\
+{									\
+	name##_HEAP_UP(head, el, el);					\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_INCREASE_KEY(struct name *head, type *el)			\
+{									\
+	uint32_t *lp = &head->hh_root;					\
+	uint32_t n;							\
+									\
+	for (n = el->field.he_pos; n > 1; n >>= 1)			\
+		lp = &IHEAP_EL(head, *lp)->field.he_link[n & 1];	\
+	name##_HEAP_DOWN(head, lp);					\
+}									\
+									\
+funprefix void								\
+name##_HEAP_DOWN(struct name *head, uint32_t *lp)			\
+{									\
+	uint32_t e = *lp;						\
+	type *el = IHEAP_EL(head, e);					\
+	uint32_t l0, li, p;						\
+									\
+	while (el->field.he_link[0] != 0) {				\
+		type *l;						\
+		int lower;						\
+		lower = el->field.he_link[1] != 0 &&			\
+		    cmp(IHEAP_EL(head, el->field.he_link[0]),		\
+		    IHEAP_EL(head, el->field.he_link[1])) > 0;		\
+		li = el->field.he_link[lower];				\
+		l = IHEAP_EL(head, li);					\
+		if (cmp(el, l) <= 0)					\
+			break;						\
+		*lp = li;						\
+		l0 = el->field.he_link[!lower];				\
+		p = el->field.he_pos;					\
+		el->field = l->field;					\
+		l->field.he_link[lower] = e;				\
+		l->field.he_link[!lower] = l0;				\
+		l->field.he_pos = p;					\
+		lp = &l->field.he_link[lower];				\
+	}								\
+}										\
+									\
+HEAP_UNUSED funprefix unsigned long					\
+name##_HEAP_CHECK_SUB(struct name *head, uint32_t e, type *parent,	\
+    unsigned long p, unsigned long k)					\
+{									\
+	type *el;							\
+									\
+	if (p > head->hh_num) {						\
+		assert(e == 0);						\
+		return 0;						\
+	}								\
+	assert(e != 0);							\
+	el = IHEAP_EL(head, e);						\
+	assert(el->field.he_pos == p);					\
+	assert(parent == NULL || cmp(parent, el) <= 0);			\
+	return 1 +							\
+	    name##_HEAP_CHECK_SUB(head, el->field.he_link[0], el,	\
+	    p + (1UL << k), k + 1) +					\
+	    name##_HEAP_CHECK_SUB(head, el->field.he_link[1], el,	\
+	    p + (2UL << k), k + 1);					\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_CHECK(struct name *head)					\
+{									\
+	assert(name##_HEAP_CHECK_SUB(head, head->hh_root, NULL, 1, 0) ==\
+	    head->hh_num);						\
 }
 
 
+#define AHEAP_HEAD(name, type)						\
+struct name {								\
+	type **hh_array;						\
+	unsigned long hh_num;						\
+	unsigned long hh_size;						\
+}
+#define AHEAP_ENTRY(type)						\
+	struct {							\
+		unsigned long he_pos;					\
+	}
+#define AHEAP_ENTRY_INITIALIZER { 0 }
+#define AHEAP_INIT(head) do {						\
+	(head)->hh_array = NULL;					\
+	(head)->hh_num = 0;						\
+	(head)->hh_size = 0;						\
+} while (0)
+#define AHEAP_FREE(name, head) do {					\
+	free((head)->hh_array);						\
+	AHEAP_INIT(head);						\
+} while (0)
+#define AHEAP_FIRST(head) ((head)->hh_num ? (head)->hh_array[1] : NULL)
+#define AHEAP_EMPTY(head) ((head)->hh_num == 0)
+#define AHEAP_INSERT(name, head, item) name##_HEAP_INSERT(head, item)
+#define AHEAP_REMOVE(name, head, item) name##_HEAP_REMOVE(head, item)
+#define AHEAP_UPDATE(name, head, item) name##_HEAP_UPDATE(head, item)
+#define AHEAP_REMOVE_HEAD(name, head) name##_HEAP_REMOVE(head, AHEAP_FIRST(head))
+#define AHEAP_UPDATE_HEAD(name, head) name##_HEAP_UPDATE(head, AHEAP_FIRST(head))
+#define AHEAP_CHECK(name, head) name##_HEAP_CHECK(head)
+
+#define AHEAP_PROTOTYPE(name, type, field, cmp, funprefix)		\
+funprefix int name##_HEAP_INSERT(struct name *, type *);		\
+funprefix void name##_HEAP_REMOVE(struct name *, type *);		\
+funprefix void name##_HEAP_UPDATE(struct name *, type *);		\
+funprefix void name##_HEAP_CHECK(struct name *);
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The AHEAP is the classic implicit binary heap. The heap keeps an array
+ * of pointers to the elements, root at index 1, children of n at 2n and
+ * 2n + 1. The elements only remember their index in the array so that
+ * they can be found for REMOVE and UPDATE.
+ *
+ * Finding the last element, the parent or the children is just arithmetic
+ * on the index, so unlike the linked heaps above we never have to chase
+ * pointers down from the root. Moving elements is done by carrying a hole
+ * up or down the array and storing the element once at the end.
+ *
+ * The array grows by doubling. INSERT returns -1 if the array can't be
+ * grown, the heap is left untouched in that case.
+ */
+#define AHEAP_GENERATE(name, type, field, cmp, funprefix)		\
+funprefix void								\
+name##_HEAP_UP(struct name *head, type *el, unsigned long n)		\
+{									\
+	type **a = head->hh_array;					\
+	unsigned long p;						\
+									\
+	while (n > 1 && cmp(el, a[p = n >> 1]) < 0) {			\
+		a[n] = a[p];						\
+		a[n]->field.he_pos = n;					\
+		n = p;							\
+	}								\
+	a[n] = el;							\
+	el->field.he_pos = n;						\
+}									\
+									\
+funprefix void								\
+name##_HEAP_DOWN(struct name *head, type *el, unsigned long n)		\
+{									\
+	type **a = head->hh_array;					\
+	unsigned long num = head->hh_num;				\
+	unsigned long c;						\
+									\
+	while ((c = n << 1) <= num) {					\
+		if (c < num && cmp(a[c + 1], a[c]) < 0)			\
+			c++;						\
+		if (cmp(el, a[c]) <= 0)					\
+			break;						\
+		a[n] = a[c];						\
+		a[n]->field.he_pos = n;					\
+		n = c;							\
+	}								\
+	a[n] = el;							\
+	el->field.he_pos = n;						\
+}									\
+									\
+funprefix int								\
+name##_HEAP_INSERT(struct name *head, type *el)				\
+{									\
+	if (head->hh_num + 1 >= head->hh_size) {			\
+		unsigned long nsize = head->hh_size ? head->hh_size * 2 : 16;\
+		type **na;						\
+									\
+		if ((na = realloc(head->hh_array, nsize * sizeof(*na))) == NULL)\
+			return -1;					\
+		head->hh_array = na;					\
+		head->hh_size = nsize;					\
+	}								\
+	name##_HEAP_UP(head, el, ++head->hh_num);			\
+	return 0;							\
+}									\
+									\
+funprefix void								\
+name##_HEAP_REMOVE(struct name *head, type *el)				\
+{									\
+	type *last = head->hh_array[head->hh_num--];			\
+									\
+	if (last == el)							\
+		return;							\
+	head->hh_array[el->field.he_pos] = last;			\
+	last->field.he_pos = el->field.he_pos;				\
+	name##_HEAP_UPDATE(head, last);					\
+}									\
+									\
+funprefix void								\
+name##_HEAP_UPDATE(struct name *head, type *el)				\
+{									\
+	unsigned long n = el->field.he_pos;				\
+									\
+	if (n > 1 && cmp(el, head->hh_array[n >> 1]) < 0)		\
+		name##_HEAP_UP(head, el, n);				\
+	else								\
+		name##_HEAP_DOWN(head, el, n);				\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_CHECK(struct name *head)					\
+{									\
+	unsigned long i;						\
+									\
+	for (i = 1; i <= head->hh_num; i++) {				\
+		assert(head->hh_array[i]->field.he_pos == i);		\
+		assert(i == 1 ||					\
+		    cmp(head->hh_array[i >> 1], head->hh_array[i]) <= 0);\
+	}								\
+}
+
+#define DHEAP_HEAD(name, type) AHEAP_HEAD(name, type)
+#define DHEAP_ENTRY(type) AHEAP_ENTRY(type)
+#define DHEAP_ENTRY_INITIALIZER AHEAP_ENTRY_INITIALIZER
+#define DHEAP_INIT(head) AHEAP_INIT(head)
+#define DHEAP_FREE(name, head) name##_HEAP_FREE(head)
+#define DHEAP_FIRST(head) ((head)->hh_num ? (head)->hh_array[0] : NULL)
+#define DHEAP_EMPTY(head) AHEAP_EMPTY(head)
+#define DHEAP_INSERT(name, head, item) name##_HEAP_INSERT(head, item)
+#define DHEAP_REMOVE(name, head, item) name##_HEAP_REMOVE(head, item)
+#define DHEAP_UPDATE(name, head, item) name##_HEAP_UPDATE(head, item)
+#define DHEAP_REMOVE_HEAD(name, head) name##_HEAP_REMOVE(head, DHEAP_FIRST(head))
+#define DHEAP_UPDATE_HEAD(name, head) name##_HEAP_UPDATE(head, DHEAP_FIRST(head))
+#define DHEAP_CHECK(name, head) name##_HEAP_CHECK(head)
+
+#define DHEAP_PROTOTYPE(name, type, field, cmp, arity, funprefix)	\
+funprefix int name##_HEAP_INSERT(struct name *, type *);		\
+funprefix void name##_HEAP_REMOVE(struct name *, type *);		\
+funprefix void name##_HEAP_UPDATE(struct name *, type *);		\
+funprefix void name##_HEAP_FREE(struct name *);				\
+funprefix void name##_HEAP_CHECK(struct name *);
+
+#define DHEAP_ALIGN 64
+
+/*
+ * The DHEAP is an implicit heap like AHEAP, but every node has arity
+ * children instead of two. The heap is half as deep with 4 children and
+ * a third as deep with 8, at the price of more compares per level.
+ *
+ * The element at index i has its children at arity * i + 1 to
+ * arity * i + arity and its parent at (i - 1) / arity. The array is
+ * allocated DHEAP_ALIGN aligned and hh_array points arity - 1 slots into
+ * it, this puts the first child of every node on an arity * sizeof(type *)
+ * boundary. With arity 8 all the children of a node are in one cache line,
+ * with 2 and 4 they never straddle two lines.
+ *
+ * Just like AHEAP, INSERT returns -1 if the array can't be grown.
+ */
+#define DHEAP_GENERATE(name, type, field, cmp, arity, funprefix)	\
+funprefix void								\
+name##_HEAP_UP(struct name *head, type *el, unsigned long n)		\
+{									\
+	type **a = head->hh_array;					\
+	unsigned long p;						\
+									\
+	while (n > 0 && cmp(el, a[p = (n - 1) / (arity)]) < 0) {	\
+		a[n] = a[p];						\
+		a[n]->field.he_pos = n;					\
+		n = p;							\
+	}								\
+	a[n] = el;							\
+	el->field.he_pos = n;						\
+}									\
+									\
+funprefix void								\
+name##_HEAP_DOWN(struct name *head, type *el, unsigned long n)		\
+{									\
+	type **a = head->hh_array;					\
+	unsigned long num = head->hh_num;				\
+	unsigned long c, e, m;						\
+									\
+	while ((c = (arity) * n + 1) < num) {				\
+		e = c + (arity) < num ? c + (arity) : num;		\
+		for (m = c++; c < e; c++)				\
+			if (cmp(a[c], a[m]) < 0)			\
+				m = c;					\
+		if (cmp(el, a[m]) <= 0)					\
+			break;						\
+		a[n] = a[m];						\
+		a[n]->field.he_pos = n;					\
+		n = m;							\
+	}								\
+	a[n] = el;							\
+	el->field.he_pos = n;						\
+}									\
+									\
+funprefix int								\
+name##_HEAP_INSERT(struct name *head, type *el)				\
+{									\
+	if (head->hh_num == head->hh_size) {				\
+		unsigned long nsize = head->hh_size ? head->hh_size * 2 : 64;\
+		void *na;						\
+									\
+		if (posix_memalign(&na, DHEAP_ALIGN,			\
+		    (nsize + (arity) - 1) * sizeof(type *)))		\
+			return -1;					\
+		if (head->hh_array != NULL) {				\
+			memcpy((type **)na + (arity) - 1, head->hh_array,\
+			    head->hh_num * sizeof(type *));		\
+			free(head->hh_array - ((arity) - 1));		\
+		}							\
+		head->hh_array = (type **)na + (arity) - 1;		\
+		head->hh_size = nsize;					\
+	}								\
+	name##_HEAP_UP(head, el, head->hh_num++);			\
+	return 0;							\
+}									\
+									\
+funprefix void								\
+name##_HEAP_REMOVE(struct name *head, type *el)				\
+{									\
+	type *last = head->hh_array[--head->hh_num];			\
+									\
+	if (last == el)							\
+		return;							\
+	head->hh_array[el->field.he_pos] = last;			\
+	last->field.he_pos = el->field.he_pos;				\
+	name##_HEAP_UPDATE(head, last);					\
+}									\
+									\
+funprefix void								\
+name##_HEAP_UPDATE(struct name *head, type *el)				\
+{									\
+	unsigned long n = el->field.he_pos;				\
+									\
+	if (n > 0 && cmp(el, head->hh_array[(n - 1) / (arity)]) < 0)	\
+		name##_HEAP_UP(head, el, n);				\
+	else								\
+		name##_HEAP_DOWN(head, el, n);				\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_FREE(struct name *head)					\
+{									\
+	if (head->hh_array != NULL)					\
+		free(head->hh_array - ((arity) - 1));			\
+	DHEAP_INIT(head);						\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_CHECK(struct name *head)					\
+{									\
+	type **a = head->hh_array;					\
+	unsigned long i;						\
+									\
+	for (i = 0; i < head->hh_num; i++) {				\
+		assert(a[i]->field.he_pos == i);			\
+		assert(i == 0 || cmp(a[(i - 1) / (arity)], a[i]) <= 0);	\
+	}								\
+}
+
+/*
+ * KDHEAP is a DHEAP for elements with a plain int key. The heap keeps a
+ * copy of every key in a second array next to the element pointers,
+ * laid out and aligned the same way, so picking the smallest child never
+ * touches the elements themselves. With arity 4 or 8 the smallest child
+ * is found with SSE4.1 or AVX2 min and compare instructions instead of
+ * a chain of unpredictable branches.
+ *
+ * The generator takes a key function instead of a compare function.
+ * Keys are compared like "a - b < 0", so just like the usual compare
+ * functions they may wrap as long as no two keys in the heap are further
+ * than INT_MAX apart. The key of an element is read on INSERT and UPDATE,
+ * changing the key without calling UPDATE breaks the heap.
+ *
+ * Which implementation is used is decided at run time the first time the
+ * heap is used. Setting heap_simd_level to 0 before that forces the
+ * scalar code, 1 allows SSE4.1, 2 allows AVX2.
+ */
+#define KDHEAP_HEAD(name, type)						\
+struct name {								\
+	type **hh_array;						\
+	int *hh_keys;							\
+	unsigned long hh_num;						\
+	unsigned long hh_size;						\
+}
+#define KDHEAP_ENTRY(type) DHEAP_ENTRY(type)
+#define KDHEAP_ENTRY_INITIALIZER DHEAP_ENTRY_INITIALIZER
+#define KDHEAP_INIT(head) do {						\
+	(head)->hh_array = NULL;					\
+	(head)->hh_keys = NULL;						\
+	(head)->hh_num = 0;						\
+	(head)->hh_size = 0;						\
+} while (0)
+#define KDHEAP_FREE(name, head) name##_HEAP_FREE(head)
+#define KDHEAP_FIRST(head) DHEAP_FIRST(head)
+#define KDHEAP_EMPTY(head) DHEAP_EMPTY(head)
+#define KDHEAP_INSERT(name, head, item) name##_HEAP_INSERT(head, item)
+#define KDHEAP_REMOVE(name, head, item) name##_HEAP_REMOVE(head, item)
+#define KDHEAP_UPDATE(name, head, item) name##_HEAP_UPDATE(head, item)
+#define KDHEAP_REMOVE_HEAD(name, head) name##_HEAP_REMOVE(head, KDHEAP_FIRST(head))
+#define KDHEAP_UPDATE_HEAD(name, head) name##_HEAP_UPDATE(head, KDHEAP_FIRST(head))
+#define KDHEAP_CHECK(name, head) name##_HEAP_CHECK(head)
+
+#define KDHEAP_PROTOTYPE(name, type, field, key, arity, funprefix)	\
+	DHEAP_PROTOTYPE(name, type, field, key, arity, funprefix)
+
+static HEAP_UNUSED int heap_simd_level = -1;
+
+/*
+ * Index of the smallest of n keys, *minrel is set to its distance to base.
+ */
+static inline unsigned long
+heap_minkey(const int *k, unsigned long n, int base, int *minrel)
+{
+	unsigned long i, m = 0;
+	int mr = k[0] - base;
+
+	for (i = 1; i < n; i++) {
+		int r = k[i] - base;
+		m = r < mr ? i : m;
+		mr = r < mr ? r : mr;
+	}
+	*minrel = mr;
+	return m;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define HEAP_TARGET(t) __attribute__((__target__(t)))
+
+static inline int
+heap_simd(void)
+{
+	if (heap_simd_level == -1) {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			heap_simd_level = 2;
+		else if (__builtin_cpu_supports("sse4.1"))
+			heap_simd_level = 1;
+		else
+			heap_simd_level = 0;
+	}
+	return heap_simd_level;
+}
+
+HEAP_TARGET("sse4.1") static inline unsigned long
+heap_minkey4_sse41(const int *k, int base, int *minrel)
+{
+	__m128i v, m;
+
+	v = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)k), _mm_set1_epi32(base));
+	m = _mm_min_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+	*minrel = _mm_cvtsi128_si32(m);
+	return __builtin_ctz(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, m))));
+}
+
+HEAP_TARGET("sse4.1") static inline unsigned long
+heap_minkey8_sse41(const int *k, int base, int *minrel)
+{
+	__m128i b, v0, v1, m;
+	int mask;
+
+	b = _mm_set1_epi32(base);
+	v0 = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)k), b);
+	v1 = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(k + 4)), b);
+	m = _mm_min_epi32(v0, v1);
+	m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+	m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+	*minrel = _mm_cvtsi128_si32(m);
+	mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v0, m))) |
+	    _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v1, m))) << 4;
+	return __builtin_ctz(mask);
+}
+
+HEAP_TARGET("avx2") static inline unsigned long
+heap_minkey8_avx2(const int *k, int base, int *minrel)
+{
+	__m256i v, m;
+
+	v = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)k), _mm256_set1_epi32(base));
+	m = _mm256_min_epi32(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	m = _mm256_min_epi32(m, _mm256_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+	m = _mm256_min_epi32(m, _mm256_permute2x128_si256(m, m, 1));
+	*minrel = _mm256_cvtsi256_si32(m);
+	return __builtin_ctz(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, m))));
+}
+#else
+#define HEAP_TARGET(t)
+#define heap_simd() 0
+#define heap_minkey4_sse41(k, base, mr) heap_minkey(k, 4, base, mr)
+#define heap_minkey8_sse41(k, base, mr) heap_minkey(k, 8, base, mr)
+#define heap_minkey8_avx2(k, base, mr) heap_minkey(k, 8, base, mr)
+#endif
+
+#define heap_minkey4_scalar(k, base, mr) heap_minkey(k, 4, base, mr)
+#define heap_minkey8_scalar(k, base, mr) heap_minkey(k, 8, base, mr)
+#define heap_minkey4_avx2(k, base, mr) heap_minkey4_sse41(k, base, mr)
+
+/*
+ * One sift down for every instruction set. Only full groups of 4 or 8
+ * children take the vector path, the last internal node and other
+ * arities go through heap_minkey.
+ */
+#define KDHEAP_DOWN_GENERATE(name, type, field, arity, funprefix, isa, attr)\
+attr funprefix void							\
+name##_HEAP_DOWN_##isa(struct name *head, type *el, int kel, unsigned long n)\
+{									\
+	type **a = head->hh_array;					\
+	int *k = head->hh_keys;						\
+	unsigned long num = head->hh_num;				\
+	unsigned long c, m;						\
+	int rel;							\
+									\
+	while ((c = (arity) * n + 1) < num) {				\
+		if ((arity) == 4 && c + 4 <= num)			\
+			m = c + heap_minkey4_##isa(k + c, kel, &rel);	\
+		else if ((arity) == 8 && c + 8 <= num)			\
+			m = c + heap_minkey8_##isa(k + c, kel, &rel);	\
+		else							\
+			m = c + heap_minkey(k + c, c + (arity) < num ?	\
+			    (arity) : num - c, kel, &rel);		\
+		if (rel >= 0)						\
+			break;						\
+		a[n] = a[m];						\
+		k[n] = k[m];						\
+		a[n]->field.he_pos = n;					\
+		n = m;							\
+	}								\
+	a[n] = el;							\
+	k[n] = kel;							\
+	el->field.he_pos = n;						\
+}
+
+#define KDHEAP_GENERATE(name, type, field, key, arity, funprefix)	\
+funprefix void								\
+name##_HEAP_UP(struct name *head, type *el, int kel, unsigned long n)	\
+{									\
+	type **a = head->hh_array;					\
+	int *k = head->hh_keys;						\
+	unsigned long p;						\
+									\
+	while (n > 0 && kel - k[p = (n - 1) / (arity)] < 0) {		\
+		a[n] = a[p];						\
+		k[n] = k[p];						\
+		a[n]->field.he_pos = n;					\
+		n = p;							\
+	}								\
+	a[n] = el;							\
+	k[n] = kel;							\
+	el->field.he_pos = n;						\
+}									\
+									\
+KDHEAP_DOWN_GENERATE(name, type, field, arity, funprefix, scalar, )	\
+KDHEAP_DOWN_GENERATE(name, type, field, arity, funprefix, sse41,	\
+    HEAP_TARGET("sse4.1"))						\
+KDHEAP_DOWN_GENERATE(name, type, field, arity, funprefix, avx2,	\
+    HEAP_TARGET("avx2"))						\
+									\
+funprefix void								\
+name##_HEAP_DOWN(struct name *head, type *el, int kel, unsigned long n)	\
+{									\
+	switch (heap_simd()) {						\
+	case 2:								\
+		name##_HEAP_DOWN_avx2(head, el, kel, n);		\
+		break;							\
+	case 1:								\
+		name##_HEAP_DOWN_sse41(head, el, kel, n);		\
+		break;							\
+	default:							\
+		name##_HEAP_DOWN_scalar(head, el, kel, n);		\
+		break;							\
+	}								\
+}									\
+									\
+funprefix int								\
+name##_HEAP_INSERT(struct name *head, type *el)				\
+{									\
+	if (head->hh_num == head->hh_size) {				\
+		unsigned long nsize = head->hh_size ? head->hh_size * 2 : 64;\
+		void *na, *nk;						\
+									\
+		if (posix_memalign(&na, DHEAP_ALIGN,			\
+		    (nsize + (arity) - 1) * sizeof(type *)))		\
+			return -1;					\
+		if (posix_memalign(&nk, DHEAP_ALIGN,			\
+		    (nsize + (arity) - 1) * sizeof(int))) {		\
+			free(na);					\
+			return -1;					\
+		}							\
+		if (head->hh_array != NULL) {				\
+			memcpy((type **)na + (arity) - 1, head->hh_array,\
+			    head->hh_num * sizeof(type *));		\
+			memcpy((int *)nk + (arity) - 1, head->hh_keys,	\
+			    head->hh_num * sizeof(int));		\
+			free(head->hh_array - ((arity) - 1));		\
+			free(head->hh_keys - ((arity) - 1));		\
+		}							\
+		head->hh_array = (type **)na + (arity) - 1;		\
+		head->hh_keys = (int *)nk + (arity) - 1;		\
+		head->hh_size = nsize;					\
+	}								\
+	name##_HEAP_UP(head, el, key(el), head->hh_num++);		\
+	return 0;							\
+}									\
+									\
+funprefix void								\
+name##_HEAP_REMOVE(struct name *head, type *el)				\
+{									\
+	type *last = head->hh_array[--head->hh_num];			\
+									\
+	if (last == el)							\
+		return;							\
+	head->hh_array[el->field.he_pos] = last;			\
+	last->field.he_pos = el->field.he_pos;				\
+	name##_HEAP_UPDATE(head, last);					\
+}									\
+									\
+funprefix void								\
+name##_HEAP_UPDATE(struct name *head, type *el)				\
+{									\
+	unsigned long n = el->field.he_pos;				\
+	int kel = key(el);						\
+									\
+	if (n > 0 && kel - head->hh_keys[(n - 1) / (arity)] < 0)	\
+		name##_HEAP_UP(head, el, kel, n);			\
+	else								\
+		name##_HEAP_DOWN(head, el, kel, n);			\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_FREE(struct name *head)					\
+{									\
+	if (head->hh_array != NULL) {					\
+		free(head->hh_array - ((arity) - 1));			\
+		free(head->hh_keys - ((arity) - 1));			\
+	}								\
+	KDHEAP_INIT(head);						\
+}									\
+									\
+/*									\
+ * The keys must be the keys of the elements and in heap order.		\
+ */									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_CHECK(struct name *head)					\
+{									\
+	int *k = head->hh_keys;						\
+	unsigned long i;						\
+									\
+	for (i = 0; i < head->hh_num; i++) {				\
+		assert(head->hh_array[i]->field.he_pos == i);		\
+		assert(k[i] == key(head->hh_array[i]));			\
+		assert(i == 0 || k[i] - k[(i - 1) / (arity)] >= 0);	\
+	}								\
+}
+
+/*
+ * RHEAP is a radix heap. It's not a heap in the sense of the other
+ * structures here, but it has the same interface and works for the common
+ * case of a priority queue where the keys are unsigned integers and the
+ * keys that are inserted are never smaller than the last key taken out,
+ * like a timer that only ever looks at what's due now or later.
+ *
+ * The elements are kept on lists in buckets. Bucket 0 has the elements
+ * with a key equal to the last key taken out (hh_last), bucket b holds
+ * the elements whose key differs from hh_last first in bit b - 1. INSERT
+ * and REMOVE are O(1). When FIRST finds bucket 0 empty it takes the
+ * lowest non-empty bucket, moves hh_last up to the smallest key in it and
+ * redistributes the bucket to lower buckets. Every element can only move
+ * down, so this is amortized O(log C) where C is the key range.
+ *
+ * The generator takes a key function that returns an unsigned long. The
+ * key is read on INSERT and UPDATE and kept in the entry, so the element
+ * may change afterwards. Inserting a key smaller than hh_last is a bug.
+ *
+ * FIRST_UPTO(bound) returns the smallest element if its key is <= bound,
+ * NULL otherwise, and never moves hh_last above bound. This is what a
+ * timer wants: look at what's due at time bound without preventing
+ * inserts of keys between bound and the smallest key.
+ */
+#define RHEAP_NBUCKETS (sizeof(unsigned long) * 8 + 1)
+
+#define RHEAP_HEAD(name, type)						\
+struct name {								\
+	type *hh_bucket[RHEAP_NBUCKETS];				\
+	unsigned long hh_last;						\
+	unsigned long hh_mask;						\
+	unsigned long hh_num;						\
+}
+#define RHEAP_ENTRY(type)						\
+	struct {							\
+		type *he_next;						\
+		type **he_prev;						\
+		unsigned long he_key;					\
+	}
+#define RHEAP_ENTRY_INITIALIZER { NULL, NULL, 0 }
+#define RHEAP_INIT(head) do {						\
+	memset((head)->hh_bucket, 0, sizeof((head)->hh_bucket));	\
+	(head)->hh_last = 0;						\
+	(head)->hh_mask = 0;						\
+	(head)->hh_num = 0;						\
+} while (0)
+#define RHEAP_EMPTY(head) ((head)->hh_num == 0)
+#define RHEAP_KEY(el, field) ((el)->field.he_key)
+#define RHEAP_FIRST(name, head) name##_HEAP_FIRST(head, ~0UL)
+#define RHEAP_FIRST_UPTO(name, head, bound) name##_HEAP_FIRST(head, bound)
+#define RHEAP_INSERT(name, head, item) name##_HEAP_INSERT(head, item)
+#define RHEAP_REMOVE(name, head, item) name##_HEAP_REMOVE(head, item)
+#define RHEAP_UPDATE(name, head, item) name##_HEAP_UPDATE(head, item)
+#define RHEAP_REMOVE_HEAD(name, head) name##_HEAP_REMOVE(head, RHEAP_FIRST(name, head))
+#define RHEAP_UPDATE_HEAD(name, head) name##_HEAP_UPDATE(head, RHEAP_FIRST(name, head))
+#define RHEAP_CHECK(name, head) name##_HEAP_CHECK(head)
+
+#define RHEAP_PROTOTYPE(name, type, field, key, funprefix)		\
+funprefix void name##_HEAP_INSERT(struct name *, type *);		\
+funprefix void name##_HEAP_REMOVE(struct name *, type *);		\
+funprefix void name##_HEAP_UPDATE(struct name *, type *);		\
+funprefix type *name##_HEAP_FIRST(struct name *, unsigned long);	\
+funprefix void name##_HEAP_CHECK(struct name *);
+
+/* The bucket for key k when the last key taken out was last. */
+static inline unsigned int
+rheap_bucket(unsigned long k, unsigned long last)
+{
+	return k == last ? 0 : sizeof(unsigned long) * 8 - __builtin_clzl(k ^ last);
+}
+
+#define RHEAP_GENERATE(name, type, field, key, funprefix)		\
+funprefix void								\
+name##_HEAP_LINK(struct name *head, type *el)				\
+{									\
+	unsigned int b = rheap_bucket(el->field.he_key, head->hh_last);	\
+	type **bp = &head->hh_bucket[b];				\
+									\
+	if ((el->field.he_next = *bp) != NULL)				\
+		(*bp)->field.he_prev = &el->field.he_next;		\
+	*bp = el;							\
+	el->field.he_prev = bp;						\
+	if (b)								\
+		head->hh_mask |= 1UL << (b - 1);			\
+}									\
+									\
+funprefix void								\
+name##_HEAP_INSERT(struct name *head, type *el)				\
+{									\
+	el->field.he_key = key(el);					\
+	name##_HEAP_LINK(head, el);					\
+	head->hh_num++;							\
+}									\
+									\
+funprefix void								\
+name##_HEAP_REMOVE(struct name *head, type *el)				\
+{									\
+	unsigned int b;							\
+									\
+	if (el->field.he_next != NULL)					\
+		el->field.he_next->field.he_prev = el->field.he_prev;	\
+	*el->field.he_prev = el->field.he_next;				\
+	head->hh_num--;							\
+	b = rheap_bucket(el->field.he_key, head->hh_last);		\
+	if (b && head->hh_bucket[b] == NULL)				\
+		head->hh_mask &= ~(1UL << (b - 1));			\
+}									\
+									\
+funprefix void								\
+name##_HEAP_UPDATE(struct name *head, type *el)				\
+{									\
+	name##_HEAP_REMOVE(head, el);					\
+	name##_HEAP_INSERT(head, el);					\
+}									\
+									\
+funprefix type *							\
+name##_HEAP_FIRST(struct name *head, unsigned long bound)		\
+{									\
+	type *el, *next;						\
+	unsigned long lowest, m;					\
+	unsigned int b;							\
+									\
+	if (head->hh_bucket[0] != NULL)					\
+		return head->hh_last <= bound ? head->hh_bucket[0] : NULL;\
+	if (head->hh_mask == 0)						\
+		return NULL;						\
+	b = __builtin_ctzl(head->hh_mask) + 1;				\
+	/*								\
+	 * Everything in bucket b is at least hh_last with bit b - 1	\
+	 * set and all the bits below it cleared.			\
+	 */								\
+	lowest = (head->hh_last | (1UL << (b - 1))) & ~((1UL << (b - 1)) - 1);\
+	if (bound < lowest)						\
+		return NULL;						\
+	m = ~0UL;							\
+	for (el = head->hh_bucket[b]; el != NULL; el = el->field.he_next)\
+		if (el->field.he_key < m)				\
+			m = el->field.he_key;				\
+	head->hh_last = m < bound ? m : bound;				\
+	el = head->hh_bucket[b];					\
+	head->hh_bucket[b] = NULL;					\
+	head->hh_mask &= ~(1UL << (b - 1));				\
+	for (; el != NULL; el = next) {					\
+		next = el->field.he_next;				\
+		name##_HEAP_LINK(head, el);				\
+	}								\
+	return head->hh_bucket[0];					\
+}									\
+									\
+/*									\
+ * Every element must be in the bucket its key says, the lists linked	\
+ * both ways and hh_mask must say which buckets aren't empty.		\
+ */									\
+HEAP_UNUSED funprefix void						\
+name##_HEAP_CHECK(struct name *head)					\
+{									\
+	unsigned long num = 0;						\
+	unsigned int b;							\
+	type **prev, *el;						\
+									\
+	for (b = 0; b < RHEAP_NBUCKETS; b++) {				\
+		assert(b == 0 || !(head->hh_mask & (1UL << (b - 1))) ==	\
+		    (head->hh_bucket[b] == NULL));			\
+		prev = &head->hh_bucket[b];				\
+		for (el = *prev; el != NULL; el = el->field.he_next) {	\
+			assert(el->field.he_prev == prev);		\
+			assert(el->field.he_key >= head->hh_last);	\
+			assert(rheap_bucket(el->field.he_key,		\
+			    head->hh_last) == b);			\
+			prev = &el->field.he_next;			\
+			num++;						\
+		}							\
+	}								\
+	assert(num == head->hh_num);					\
+}
+
 #endif /*HEAP_H*/
 
@@ -0,0 +1,473 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "heap.h"
+#include "avl.h"
+
+/*
+ * Randomized test of all the heaps against a reference. Every element
+ * is on all the heaps at the same time and in an avl tree sorted by
+ * value, every operation is done on all of them and the smallest
+ * element of every heap must be the smallest element in the tree. Every
+ * now and then the heaps are checked with their CHECK function.
+ *
+ * The values are unique (the low bits are the index of the element) so
+ * there are no ties and all heaps have to agree on which element is the
+ * smallest. The values are never smaller than the smallest value seen
+ * when looking at the top of the heaps, so RHEAP can take part.
+ *
+ * HEAP can only change its first element, so it's only used in rounds
+ * where nothing else is done. In the other rounds arbitrary elements
+ * are removed and updated.
+ *
+ * The operations are read from a byte stream. Built with -DFUZZER it's
+ * a libFuzzer target and the bytes are the fuzzer input, otherwise the
+ * bytes are random and it runs for as many operations as asked.
+ */
+
+#define POOLBITS	10
+#define POOLSIZE	(1 << POOLBITS)
+/* Start over before the values get anywhere near wrapping. */
+#define MAXKEY		(1 << 20)
+
+struct fel {
+	HEAP_ENTRY(struct fel) h;
+	PHEAP_ENTRY(struct fel) p;
+	CHEAP_ENTRY(struct fel) c;
+	IHEAP_ENTRY(struct fel) i;
+	AHEAP_ENTRY(struct fel) a;
+	DHEAP_ENTRY(struct fel) d2, d3, d8;
+	KDHEAP_ENTRY(struct fel) kd4, kd8;
+	RHEAP_ENTRY(struct fel) r;
+	struct avl_node ref;
+	int val;
+	int onq;
+};
+
+#define fel_cmp(a, b) ((a)->val - (b)->val)
+#define fel_key(el) ((el)->val)
+#define fel_rkey(el) ((unsigned long)(el)->val)
+
+HEAP_HEAD(hh, struct fel) hh_root;
+HEAP_PROTOTYPE(hh, struct fel, h, fel_cmp, static)
+HEAP_GENERATE(hh, struct fel, h, fel_cmp, static)
+
+PHEAP_HEAD(ph, struct fel) ph_root;
+PHEAP_PROTOTYPE(ph, struct fel, p, fel_cmp, static)
+PHEAP_GENERATE(ph, struct fel, p, fel_cmp, static)
+
+CHEAP_HEAD(ch, struct fel) ch_root;
+CHEAP_PROTOTYPE(ch, struct fel, c, fel_cmp, static)
+CHEAP_GENERATE(ch, struct fel, c, fel_cmp, static)
+
+IHEAP_HEAD(ih, struct fel) ih_root;
+IHEAP_PROTOTYPE(ih, struct fel, i, fel_cmp, static)
+IHEAP_GENERATE(ih, struct fel, i, fel_cmp, static)
+
+AHEAP_HEAD(ah, struct fel) ah_root;
+AHEAP_PROTOTYPE(ah, struct fel, a, fel_cmp, static)
+AHEAP_GENERATE(ah, struct fel, a, fel_cmp, static)
+
+DHEAP_HEAD(dh2, struct fel) dh2_root;
+DHEAP_PROTOTYPE(dh2, struct fel, d2, fel_cmp, 2, static)
+DHEAP_GENERATE(dh2, struct fel, d2, fel_cmp, 2, static)
+
+DHEAP_HEAD(dh3, struct fel) dh3_root;
+DHEAP_PROTOTYPE(dh3, struct fel, d3, fel_cmp, 3, static)
+DHEAP_GENERATE(dh3, struct fel, d3, fel_cmp, 3, static)
+
+DHEAP_HEAD(dh8, struct fel) dh8_root;
+DHEAP_PROTOTYPE(dh8, struct fel, d8, fel_cmp, 8, static)
+DHEAP_GENERATE(dh8, struct fel, d8, fel_cmp, 8, static)
+
+KDHEAP_HEAD(kdh4, struct fel) kdh4_root;
+KDHEAP_PROTOTYPE(kdh4, struct fel, kd4, fel_key, 4, static)
+KDHEAP_GENERATE(kdh4, struct fel, kd4, fel_key, 4, static)
+
+KDHEAP_HEAD(kdh8, struct fel) kdh8_root;
+KDHEAP_PROTOTYPE(kdh8, struct fel, kd8, fel_key, 8, static)
+KDHEAP_GENERATE(kdh8, struct fel, kd8, fel_key, 8, static)
+
+RHEAP_HEAD(rh, struct fel) rh_root;
+RHEAP_PROTOTYPE(rh, struct fel, r, fel_rkey, static)
+RHEAP_GENERATE(rh, struct fel, r, fel_rkey, static)
+
+static struct fel pool[POOLSIZE];
+static struct avl_node *ref_root;
+static int nref;
+static int lowest;
+static int headonly;
+
+static int
+ref_cmp(const struct avl_node *a, const struct avl_node *b)
+{
+	return avl_data(a, struct fel, ref)->val - avl_data(b, struct fel, ref)->val;
+}
+
+static struct fel *
+ref_first(void)
+{
+	struct avl_node *n;
+
+	if ((n = ref_root) == NULL)
+		return NULL;
+	while (n->link[0] != NULL)
+		n = n->link[0];
+	return avl_data(n, struct fel, ref);
+}
+
+/*
+ * The byte stream.
+ */
+static const uint8_t *in;
+static size_t inlen;
+
+static uint32_t
+fuzz_random(void)
+{
+	static uint32_t x = 1;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+static unsigned int
+next(void)
+{
+	if (in == NULL)
+		return fuzz_random() & 0xff;
+	if (inlen == 0)
+		return 0;
+	inlen--;
+	return *in++;
+}
+
+static int
+new_val(struct fel *el)
+{
+	return ((lowest >> POOLBITS) + next() + 1) << POOLBITS | (int)(el - pool);
+}
+
+static void
+heaps_init(void)
+{
+	HEAP_INIT(&hh_root);
+	PHEAP_INIT(&ph_root);
+	CHEAP_INIT(&ch_root);
+	IHEAP_INIT(&ih_root, pool);
+	AHEAP_INIT(&ah_root);
+	DHEAP_INIT(&dh2_root);
+	DHEAP_INIT(&dh3_root);
+	DHEAP_INIT(&dh8_root);
+	KDHEAP_INIT(&kdh4_root);
+	KDHEAP_INIT(&kdh8_root);
+	RHEAP_INIT(&rh_root);
+	ref_root = NULL;
+	nref = 0;
+	lowest = 0;
+	memset(pool, 0, sizeof(pool));
+}
+
+static void
+heaps_check(void)
+{
+	if (headonly)
+		HEAP_CHECK(hh, &hh_root);
+	PHEAP_CHECK(ph, &ph_root);
+	CHEAP_CHECK(ch, &ch_root);
+	IHEAP_CHECK(ih, &ih_root);
+	AHEAP_CHECK(ah, &ah_root);
+	DHEAP_CHECK(dh2, &dh2_root);
+	DHEAP_CHECK(dh3, &dh3_root);
+	DHEAP_CHECK(dh8, &dh8_root);
+	KDHEAP_CHECK(kdh4, &kdh4_root);
+	KDHEAP_CHECK(kdh8, &kdh8_root);
+	RHEAP_CHECK(rh, &rh_root);
+	assert(ch_root.hh_num == nref);
+	assert(rh_root.hh_num == (unsigned long)nref);
+	if (ref_root != NULL)
+		avl_check(ref_root, ref_cmp);
+}
+
+/*
+ * Compare the first element of all heaps with the reference. This is
+ * the only place where RHEAP_FIRST is called and it moves up the
+ * smallest key RHEAP can take, so it moves up lowest too.
+ */
+static struct fel *
+heaps_first(void)
+{
+	struct fel *el = ref_first();
+
+	if (headonly)
+		assert(HEAP_FIRST(&hh_root) == el);
+	assert(PHEAP_FIRST(&ph_root) == el);
+	assert(CHEAP_FIRST(&ch_root) == el);
+	assert(IHEAP_FIRST(&ih_root) == el);
+	assert(AHEAP_FIRST(&ah_root) == el);
+	assert(DHEAP_FIRST(&dh2_root) == el);
+	assert(DHEAP_FIRST(&dh3_root) == el);
+	assert(DHEAP_FIRST(&dh8_root) == el);
+	assert(KDHEAP_FIRST(&kdh4_root) == el);
+	assert(KDHEAP_FIRST(&kdh8_root) == el);
+	assert(RHEAP_FIRST(rh, &rh_root) == el);
+	if (el != NULL)
+		lowest = el->val;
+	return el;
+}
+
+static void
+heaps_insert(struct fel *el)
+{
+	el->val = new_val(el);
+	el->onq = 1;
+	avl_insert(&el->ref, &ref_root, ref_cmp);
+	nref++;
+	if (headonly)
+		HEAP_INSERT(hh, &hh_root, el);
+	PHEAP_INSERT(ph, &ph_root, el);
+	CHEAP_INSERT(ch, &ch_root, el);
+	IHEAP_INSERT(ih, &ih_root, el);
+	if (AHEAP_INSERT(ah, &ah_root, el) ||
+	    DHEAP_INSERT(dh2, &dh2_root, el) ||
+	    DHEAP_INSERT(dh3, &dh3_root, el) ||
+	    DHEAP_INSERT(dh8, &dh8_root, el) ||
+	    KDHEAP_INSERT(kdh4, &kdh4_root, el) ||
+	    KDHEAP_INSERT(kdh8, &kdh8_root, el))
+		err(1, "insert");
+	RHEAP_INSERT(rh, &rh_root, el);
+}
+
+/*
+ * Insert up to n elements, CHEAP gets them with INSERT_BATCH and HEAP
+ * with BUILD if it's empty.
+ */
+static void
+heaps_insert_batch(int n)
+{
+	struct fel *items[POOLSIZE];
+	struct fel *el;
+	int i, k;
+
+	for (i = k = 0; i < POOLSIZE && k < n; i++) {
+		el = &pool[i];
+		if (el->onq)
+			continue;
+		el->val = new_val(el);
+		el->onq = 1;
+		avl_insert(&el->ref, &ref_root, ref_cmp);
+		nref++;
+		items[k++] = el;
+		IHEAP_INSERT(ih, &ih_root, el);
+		PHEAP_INSERT(ph, &ph_root, el);
+		if (AHEAP_INSERT(ah, &ah_root, el) ||
+		    DHEAP_INSERT(dh2, &dh2_root, el) ||
+		    DHEAP_INSERT(dh3, &dh3_root, el) ||
+		    DHEAP_INSERT(dh8, &dh8_root, el) ||
+		    KDHEAP_INSERT(kdh4, &kdh4_root, el) ||
+		    KDHEAP_INSERT(kdh8, &kdh8_root, el))
+			err(1, "insert");
+		RHEAP_INSERT(rh, &rh_root, el);
+	}
+	CHEAP_INSERT_BATCH(ch, &ch_root, items, k);
+	if (headonly) {
+		if (HEAP_EMPTY(&hh_root)) {
+			HEAP_BUILD(hh, &hh_root, items, k);
+		} else {
+			for (i = 0; i < k; i++)
+				HEAP_INSERT(hh, &hh_root, items[i]);
+		}
+	}
+}
+
+static void
+heaps_remove(struct fel *el)
+{
+	avl_delete(&el->ref, &ref_root, ref_cmp);
+	nref--;
+	el->onq = 0;
+	PHEAP_REMOVE(ph, &ph_root, el);
+	CHEAP_REMOVE(ch, &ch_root, el);
+	IHEAP_REMOVE(ih, &ih_root, el);
+	AHEAP_REMOVE(ah, &ah_root, el);
+	DHEAP_REMOVE(dh2, &dh2_root, el);
+	DHEAP_REMOVE(dh3, &dh3_root, el);
+	DHEAP_REMOVE(dh8, &dh8_root, el);
+	KDHEAP_REMOVE(kdh4, &kdh4_root, el);
+	KDHEAP_REMOVE(kdh8, &kdh8_root, el);
+	RHEAP_REMOVE(rh, &rh_root, el);
+}
+
+static void
+heaps_remove_head(void)
+{
+	struct fel *el;
+
+	if ((el = heaps_first()) == NULL)
+		return;
+	if (headonly)
+		HEAP_REMOVE_HEAD(hh, &hh_root);
+	heaps_remove(el);
+}
+
+/*
+ * Give el a new value. With bykey CHEAP and IHEAP get told which way
+ * the value went instead of a plain UPDATE.
+ */
+static void
+heaps_update(struct fel *el, int bykey)
+{
+	int old = el->val;
+
+	avl_delete(&el->ref, &ref_root, ref_cmp);
+	el->val = new_val(el);
+	avl_insert(&el->ref, &ref_root, ref_cmp);
+	if (headonly)
+		HEAP_UPDATE_HEAD(hh, &hh_root);
+	PHEAP_UPDATE(ph, &ph_root, el);
+	if (bykey && el->val > old) {
+		CHEAP_INCREASE_KEY(ch, &ch_root, el);
+		IHEAP_INCREASE_KEY(ih, &ih_root, el);
+	} else if (bykey) {
+		CHEAP_DECREASE_KEY(ch, &ch_root, el);
+		IHEAP_DECREASE_KEY(ih, &ih_root, el);
+	} else {
+		CHEAP_UPDATE(ch, &ch_root, el);
+		IHEAP_UPDATE(ih, &ih_root, el);
+	}
+	AHEAP_UPDATE(ah, &ah_root, el);
+	DHEAP_UPDATE(dh2, &dh2_root, el);
+	DHEAP_UPDATE(dh3, &dh3_root, el);
+	DHEAP_UPDATE(dh8, &dh8_root, el);
+	KDHEAP_UPDATE(kdh4, &kdh4_root, el);
+	KDHEAP_UPDATE(kdh8, &kdh8_root, el);
+	RHEAP_UPDATE(rh, &rh_root, el);
+}
+
+static void
+heaps_fini(void)
+{
+	struct fel *el;
+
+	while ((el = heaps_first()) != NULL)
+		heaps_remove_head();
+	heaps_check();
+	AHEAP_FREE(ah, &ah_root);
+	DHEAP_FREE(dh2, &dh2_root);
+	DHEAP_FREE(dh3, &dh3_root);
+	DHEAP_FREE(dh8, &dh8_root);
+	KDHEAP_FREE(kdh4, &kdh4_root);
+	KDHEAP_FREE(kdh8, &kdh8_root);
+}
+
+/*
+ * Run nops operations (or until the input runs out), check the heaps
+ * every checkevery operations.
+ */
+static void
+fuzz(long nops, int checkevery)
+{
+	struct fel *el;
+	long op;
+
+	heaps_init();
+	headonly = next() & 1;
+	for (op = 0; op < nops && (in == NULL || inlen > 0); op++) {
+		if (lowest > MAXKEY) {
+			heaps_fini();
+			heaps_init();
+		}
+		switch (next() % 8) {
+		case 0:
+		case 1:
+		case 2:
+			el = &pool[(next() << 8 | next()) % POOLSIZE];
+			if (!el->onq)
+				heaps_insert(el);
+			break;
+		case 3:
+			heaps_insert_batch(next());
+			break;
+		case 4:
+			heaps_remove_head();
+			break;
+		case 5:
+			if ((el = heaps_first()) != NULL)
+				heaps_update(el, next() & 1);
+			break;
+		case 6:
+			el = &pool[(next() << 8 | next()) % POOLSIZE];
+			if (!headonly && el->onq)
+				heaps_remove(el);
+			break;
+		case 7:
+			el = &pool[(next() << 8 | next()) % POOLSIZE];
+			if (!headonly && el->onq)
+				heaps_update(el, next() & 1);
+			break;
+		}
+		if (op % checkevery == 0)
+			heaps_check();
+	}
+	heaps_check();
+	heaps_fini();
+}
+
+#ifdef FUZZER
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	in = data;
+	inlen = size;
+	fuzz(size, 1);
+	return 0;
+}
+#else
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: heap_fuzz [-c checkevery] [-n ops] [-r rounds] [-S simdlevel]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	long nops = 100000;
+	int rounds = 10, checkevery = 64;
+	int i, ch;
+
+	while ((ch = getopt(argc, argv, "c:n:r:S:")) != -1) {
+		switch (ch) {
+		case 'c':
+			if ((checkevery = atoi(optarg)) < 1)
+				usage();
+			break;
+		case 'n':
+			nops = atol(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'S':
+			heap_simd_level = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	for (i = 0; i < rounds; i++)
+		fuzz(nops, checkevery);
+	printf("%d rounds of %ld operations\n", rounds, nops);
+
+	return 0;
+}
+#endif
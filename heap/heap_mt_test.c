@@ -0,0 +1,355 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mtheap.h"
+
+/*
+ * Threaded version of heap_test. Every thread owns a slice of the
+ * elements and runs the same insert/update/remove mix on one shared
+ * queue. We report the total number of operations per second for a
+ * growing number of threads.
+ */
+
+struct el {
+	union {
+		CHEAP_ENTRY(struct el) c;
+		MQHEAP_ENTRY(struct el) mq;
+		SHEAP_ENTRY(struct el) sh;
+	} link;
+	int onq;
+	int val;
+};
+
+static inline int
+el_cmp(const struct el *a, const struct el *b)
+{
+	return a->val - b->val;
+}
+
+/*
+ * The baseline, one CHEAP behind one lock. Like the timeouts today.
+ */
+CHEAP_HEAD(ch, struct el) ch_root;
+CHEAP_PROTOTYPE(ch, struct el, link.c, el_cmp, static)
+CHEAP_GENERATE(ch, struct el, link.c, el_cmp, static)
+pthread_mutex_t ch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+MQHEAP_HEAD(mq, struct el) mq_root;
+MQHEAP_PROTOTYPE(mq, struct el, link.mq, el_cmp, static)
+MQHEAP_GENERATE(mq, struct el, link.mq, el_cmp, static)
+
+/* One shard per thread. */
+SHEAP_HEAD(sh, struct el) sh_root;
+SHEAP_PROTOTYPE(sh, struct el, link.sh, el_cmp, mtheap_thread, static)
+SHEAP_GENERATE(sh, struct el, link.sh, el_cmp, mtheap_thread, static)
+
+struct variant {
+	const char *name;
+	void (*init)(int);
+	void (*fini)(void);
+	void (*insert)(struct el *);
+	int (*remove)(struct el *);
+	struct el *(*remove_min)(void);
+	int (*onqueue)(struct el *);
+};
+
+static void
+ch_init(int nthreads)
+{
+	CHEAP_INIT(&ch_root);
+}
+
+static void
+ch_fini(void)
+{
+}
+
+static void
+ch_insert(struct el *el)
+{
+	pthread_mutex_lock(&ch_lock);
+	CHEAP_INSERT(ch, &ch_root, el);
+	el->onq = 1;
+	pthread_mutex_unlock(&ch_lock);
+}
+
+static int
+ch_remove(struct el *el)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&ch_lock);
+	if (el->onq) {
+		CHEAP_REMOVE(ch, &ch_root, el);
+		el->onq = 0;
+		ret = 1;
+	}
+	pthread_mutex_unlock(&ch_lock);
+	return ret;
+}
+
+static struct el *
+ch_remove_min(void)
+{
+	struct el *el;
+
+	pthread_mutex_lock(&ch_lock);
+	if ((el = CHEAP_FIRST(&ch_root)) != NULL) {
+		CHEAP_REMOVE(ch, &ch_root, el);
+		el->onq = 0;
+	}
+	pthread_mutex_unlock(&ch_lock);
+	return el;
+}
+
+static int
+ch_onqueue(struct el *el)
+{
+	return __atomic_load_n(&el->onq, __ATOMIC_RELAXED);
+}
+
+/* Four queues per thread. */
+static void
+mq_init(int nthreads)
+{
+	if (MQHEAP_INIT(mq, &mq_root, nthreads * 4))
+		err(1, "mq_init");
+}
+
+static void
+mq_fini(void)
+{
+	MQHEAP_DESTROY(mq, &mq_root);
+}
+
+static void
+mq_insert(struct el *el)
+{
+	MQHEAP_INSERT(mq, &mq_root, el);
+}
+
+static int
+mq_remove(struct el *el)
+{
+	return MQHEAP_REMOVE(mq, &mq_root, el);
+}
+
+static struct el *
+mq_remove_min(void)
+{
+	return MQHEAP_REMOVE_MIN(mq, &mq_root);
+}
+
+static int
+mq_onqueue(struct el *el)
+{
+	return MQHEAP_ONQUEUE(el, link.mq);
+}
+
+static void
+sh_init(int nthreads)
+{
+	if (SHEAP_INIT(sh, &sh_root, nthreads))
+		err(1, "sh_init");
+}
+
+static void
+sh_fini(void)
+{
+	SHEAP_DESTROY(sh, &sh_root);
+}
+
+static void
+sh_insert(struct el *el)
+{
+	SHEAP_INSERT(sh, &sh_root, el);
+}
+
+static int
+sh_remove(struct el *el)
+{
+	return SHEAP_REMOVE(sh, &sh_root, el);
+}
+
+/*
+ * The first element can be taken by someone else between looking at
+ * it and removing it, then we just try again.
+ */
+static struct el *
+sh_remove_min(void)
+{
+	struct el *el;
+
+	while ((el = SHEAP_FIRST(&sh_root)) != NULL)
+		if (SHEAP_REMOVE(sh, &sh_root, el))
+			break;
+	return el;
+}
+
+static int
+sh_onqueue(struct el *el)
+{
+	return SHEAP_ONQUEUE(el, link.sh);
+}
+
+struct variant variants[] = {
+	{ "locked", ch_init, ch_fini, ch_insert, ch_remove, ch_remove_min, ch_onqueue },
+	{ "mq", mq_init, mq_fini, mq_insert, mq_remove, mq_remove_min, mq_onqueue },
+	{ "sharded", sh_init, sh_fini, sh_insert, sh_remove, sh_remove_min, sh_onqueue },
+};
+
+struct thr {
+	pthread_t t;
+	const struct variant *v;
+	struct el *elems;
+	int nelem;
+	int nops;
+};
+
+static volatile int go;
+
+static void *
+thr_run(void *arg)
+{
+	struct thr *t = arg;
+	const struct variant *v = t->v;
+	struct el *el;
+	int now = 0;
+	int i, cursor = 0;
+
+	while (!go)
+		;
+
+	for (i = 0; i < t->nops; i++) {
+		el = &t->elems[mtheap_random() % t->nelem];
+		switch (mtheap_random() % 10) {
+		case 0:
+		case 1:
+		case 2:
+		case 3:
+		case 4:
+		case 5:
+			/* Insert the next element that isn't queued. */
+			el = &t->elems[cursor];
+			cursor = (cursor + 1) % t->nelem;
+			if (v->onqueue(el))
+				break;
+			el->val = now + mtheap_random() % t->nelem;
+			v->insert(el);
+			break;
+		case 6:
+		case 7:
+			if (!v->remove(el))
+				break;
+			el->val = now + mtheap_random() % 10;
+			v->insert(el);
+			break;
+		case 8:
+		case 9:
+			if ((el = v->remove_min()) != NULL)
+				now = el->val;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static double
+run_one(const struct variant *v, int nthreads, int nelem, int nops)
+{
+	struct thr *thr;
+	struct el *elems;
+	double start, elapsed;
+	int per = nelem / nthreads;
+	int i;
+
+	if ((elems = calloc(nelem, sizeof(*elems))) == NULL)
+		err(1, "calloc");
+	if ((thr = calloc(nthreads, sizeof(*thr))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < nelem; i++)
+		MQHEAP_ELEM_INIT(&elems[i], link.mq);
+
+	v->init(nthreads);
+	go = 0;
+	for (i = 0; i < nthreads; i++) {
+		thr[i].v = v;
+		thr[i].elems = &elems[i * per];
+		thr[i].nelem = per;
+		thr[i].nops = nops / nthreads;
+		if (pthread_create(&thr[i].t, NULL, thr_run, &thr[i]))
+			errx(1, "pthread_create");
+	}
+	start = now_sec();
+	go = 1;
+	for (i = 0; i < nthreads; i++)
+		pthread_join(thr[i].t, NULL);
+	elapsed = now_sec() - start;
+
+	while (v->remove_min() != NULL)
+		;
+	v->fini();
+	free(thr);
+	free(elems);
+
+	return (double)(nops / nthreads) * nthreads / elapsed;
+}
+
+#ifndef nitems
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+#endif
+int threads[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: heap_mt_test [-e nelem] [-o nops]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	int nelem = 1000000, nops = 4000000;
+	int i, j, ch;
+
+	while ((ch = getopt(argc, argv, "e:o:")) != -1) {
+		switch (ch) {
+		case 'e':
+			nelem = atoi(optarg);
+			break;
+		case 'o':
+			nops = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	for (i = 0; i < nitems(threads); i++) {
+		if (nelem / threads[i] == 0)
+			break;
+		printf("%d", threads[i]);
+		for (j = 0; j < nitems(variants); j++)
+			printf(" %f", run_one(&variants[j], threads[i], nelem, nops));
+		printf("\n");
+		fflush(stdout);
+	}
+
+	return 0;
+}
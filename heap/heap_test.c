@@ -3,56 +3,65 @@
 #include <err.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
 
 #include "heap.h"
+#include "arena.h"
+#include "bench.h"
+#include "trace.h"
 
-#if 0
-#include <sys/resource.h>
-#else
-#ifdef __MACH__
-#include <mach/mach_time.h>
-#endif
-#endif
-
+/*
+ * Only for the build test, the run test below has one element type per
+ * heap variant so that the size of the linkage shows up in the memory
+ * use.
+ */
 struct el {
-	PHEAP_ENTRY(struct el) link;
+	union {
+		HEAP_ENTRY(struct el) h;
+		CHEAP_ENTRY(struct el) c;
+	} link;
 	int val;
 };
 
-static inline int
-el_cmp(const struct el *a, const struct el *b)
-{
-	return a->val - b->val;
-}
+#define el_cmp(a, b) ((a)->val - (b)->val)
+#define el_key(el) ((el)->val)
 
-PHEAP_HEAD(h, struct el) heap_root;
+HEAP_HEAD(hh, struct el) hh_root;
+HEAP_PROTOTYPE(hh, struct el, link.h, el_cmp, static)
+HEAP_GENERATE(hh, struct el, link.h, el_cmp, static)
 
-PHEAP_PROTOTYPE(h, struct el, link, el_cmp, static)
+CHEAP_HEAD(ch, struct el) ch_root;
+CHEAP_PROTOTYPE(ch, struct el, link.c, el_cmp, static)
+CHEAP_GENERATE(ch, struct el, link.c, el_cmp, static)
 
-PHEAP_GENERATE(h, struct el, link, el_cmp, static)
-
-static uint64_t
-timestamp(void)
+/*
+ * Resident memory in bytes. Without /proc it's the peak, which is
+ * good enough when every run uses more memory than the one before.
+ */
+static long
+rss(void)
 {
-#if 0
+#ifdef __linux__
+	FILE *f;
+	long size, res = 0;
+
+	if ((f = fopen("/proc/self/statm", "r")) != NULL) {
+		if (fscanf(f, "%ld %ld", &size, &res) != 2)
+			res = 0;
+		fclose(f);
+	}
+	return res * sysconf(_SC_PAGESIZE);
+#else
 	struct rusage ru;
+
 	getrusage(RUSAGE_SELF, &ru);
-	return ((uint64_t)ru.ru_utime.tv_sec * 1000000ULL) + (uint64_t)ru.ru_utime.tv_usec;
+#ifdef __MACH__
+	return ru.ru_maxrss;
 #else
-	return mach_absolute_time();
+	return ru.ru_maxrss * 1024L;
 #endif
-}
-
-static double
-ts2ns(uint64_t ts)
-{
-#if 0
-	return (double)ts * 1000.0;
-#else
-	static mach_timebase_info_data_t tb;
-	if (tb.denom == 0)
-		mach_timebase_info(&tb);
-	return ((double)ts * (double)tb.numer / (double)tb.denom);
 #endif
 }
 
@@ -63,92 +72,521 @@ heap_depth(struct el *el)
 	int l, r;
 	if (el == NULL)
 		return 0;
-	l = heap_depth(el->link.he_link[0]);
-	r = heap_depth(el->link.he_link[1]);
+	l = heap_depth(el->link.p.he_link[0]);
+	r = heap_depth(el->link.p.he_link[1]);
 
 	return 1 + (l > r ? l : r);
 }
 #endif
 
+/* -M */
+int arena_flags;
+int arena_node = -1;
+
+static void *
+elems_alloc(struct arena *a, size_t n, size_t size)
+{
+	if (arena_init(a, n, size, arena_flags, arena_node) == -1)
+		err(1, "arena_init");
+	if (arena_flags & ARENA_SHUFFLE)
+		arena_shuffle(a, bench_random());
+	return a->a_base;
+}
+
+struct opstats {
+	struct bench_hist ins, upd, rem;
+	uint64_t ins_pmu[BENCH_PMU_MAX];
+	uint64_t upd_pmu[BENCH_PMU_MAX];
+	uint64_t rem_pmu[BENCH_PMU_MAX];
+	long rss;
+};
+
+/*
+ * The same workloads for every heap variant, run_ makes one up,
+ * replay_ replays a trace. kind is the macro prefix
+ * (PHEAP, AHEAP, ...), name the generated heap and the rest of the
+ * arguments what goes between the field and funprefix in the
+ * generator. init and fini set up and tear down the head.
+ *
+ * Every variant is generated for elements of 16, 64 and 256 bytes,
+ * or bigger if the linkage doesn't fit, named name16, name64 and
+ * name256. HEAP only has the head operations and can't replay.
+ */
+#define RUN_GENERATE(kind, name, init, fini, ...)			\
+	RUN_GENERATE_ONE(kind, name##16, 16, init, fini, __VA_ARGS__)	\
+	REPLAY_GENERATE(kind, name##16, init, fini)			\
+	RUN_GENERATE_ONE(kind, name##64, 64, init, fini, __VA_ARGS__)	\
+	REPLAY_GENERATE(kind, name##64, init, fini)			\
+	RUN_GENERATE_ONE(kind, name##256, 256, init, fini, __VA_ARGS__)	\
+	REPLAY_GENERATE(kind, name##256, init, fini)
+
+#define RUN_GENERATE_HEADONLY(kind, name, init, fini, ...)		\
+	RUN_GENERATE_ONE(kind, name##16, 16, init, fini, __VA_ARGS__)	\
+	RUN_GENERATE_ONE(kind, name##64, 64, init, fini, __VA_ARGS__)	\
+	RUN_GENERATE_ONE(kind, name##256, 256, init, fini, __VA_ARGS__)
+
+#define RUN_GENERATE_ONE(kind, name, size, init, fini, ...)		\
+struct name##_el {							\
+	union {								\
+		struct {						\
+			kind##_ENTRY(struct name##_el) link;		\
+			int val;					\
+		};							\
+		char payload[size];					\
+	};								\
+};									\
+kind##_HEAD(name, struct name##_el) name##_root;			\
+kind##_PROTOTYPE(name, struct name##_el, link, __VA_ARGS__, static)	\
+kind##_GENERATE(name, struct name##_el, link, __VA_ARGS__, static)	\
+									\
+static void								\
+run_##name(int nelem, struct opstats *st)				\
+{									\
+	struct name##_el *elems, *el;					\
+	struct name *head = &name##_root;				\
+	struct arena a;							\
+	int lowest = 0;							\
+	uint64_t s, pc[BENCH_PMU_MAX];					\
+	long r;								\
+	int added;							\
+									\
+	r = rss();							\
+	elems = elems_alloc(&a, nelem, sizeof(*elems));			\
+	init(kind, head, elems);					\
+									\
+	added = 0;							\
+	while (added < nelem || kind##_FIRST(head)) {			\
+		switch (bench_random_uniform(10)) {			\
+		case 0:							\
+		case 1:							\
+		case 2:							\
+		case 3:							\
+		case 4:							\
+		case 5:							\
+			if (added < nelem) {				\
+				el = arena_alloc(&a);			\
+				added++;				\
+				el->val = lowest + bench_random_uniform(nelem);\
+				bench_pmu_start(pc);			\
+				s = bench_now();			\
+				kind##_INSERT(name, head, el);		\
+				bench_hist_add(&st->ins, bench_since(s));\
+				bench_pmu_stop(pc, st->ins_pmu);	\
+			}						\
+			break;						\
+		case 6:							\
+		case 7:							\
+			if ((el = kind##_FIRST(head)) != NULL) {	\
+				el->val = lowest + bench_random_uniform(10);\
+				bench_pmu_start(pc);			\
+				s = bench_now();			\
+				kind##_UPDATE_HEAD(name, head);		\
+				bench_hist_add(&st->upd, bench_since(s));\
+				bench_pmu_stop(pc, st->upd_pmu);	\
+			}						\
+			break;						\
+		case 8:							\
+		case 9:							\
+			if ((el = kind##_FIRST(head)) != NULL) {	\
+				assert(lowest <= el->val);		\
+				lowest = el->val;			\
+				bench_pmu_start(pc);			\
+				s = bench_now();			\
+				kind##_REMOVE_HEAD(name, head);		\
+				bench_hist_add(&st->rem, bench_since(s));\
+				bench_pmu_stop(pc, st->rem_pmu);	\
+			}						\
+			break;						\
+		}							\
+		/* Everything is in the heap at least once here. */	\
+		if (added == nelem && st->rss == 0)			\
+			st->rss = rss() - r;				\
+	}								\
+	fini(kind, name, head);						\
+	arena_fini(&a);							\
+}
+
+#define REPLAY_GENERATE(kind, name, init, fini)				\
+static void								\
+replay_##name(const struct trace *t, struct opstats *st)		\
+{									\
+	const struct trace_rec *tr, *end = t->t_rec + t->t_nrec;	\
+	struct name##_el *elems, *el;					\
+	struct name *head = &name##_root;				\
+	struct arena a;							\
+	char *onq;							\
+	int now = 0, n;							\
+	uint64_t s, pc[BENCH_PMU_MAX];					\
+	long r;								\
+									\
+	r = rss();							\
+	elems = elems_alloc(&a, t->t_nid + 1, sizeof(*elems));		\
+	if ((onq = calloc(t->t_nid + 1, 1)) == NULL)			\
+		err(1, "calloc");					\
+	init(kind, head, elems);					\
+									\
+	for (tr = t->t_rec; tr < end; tr++) {				\
+		switch (TRACE_OP(tr)) {					\
+		case TRACE_INSERT:					\
+		case TRACE_UPDATE:					\
+			assert(TRACE_ID(tr) < t->t_nid);		\
+			el = arena_slot(&a, TRACE_ID(tr));		\
+			el->val = now + tr->tr_key;			\
+			if (onq[el - elems]) {				\
+				bench_pmu_start(pc);			\
+				s = bench_now();			\
+				kind##_UPDATE(name, head, el);		\
+				bench_hist_add(&st->upd, bench_since(s));\
+				bench_pmu_stop(pc, st->upd_pmu);	\
+			} else {					\
+				bench_pmu_start(pc);			\
+				s = bench_now();			\
+				kind##_INSERT(name, head, el);		\
+				bench_hist_add(&st->ins, bench_since(s));\
+				bench_pmu_stop(pc, st->ins_pmu);	\
+				onq[el - elems] = 1;			\
+			}						\
+			break;						\
+		case TRACE_REMOVE:					\
+			assert(TRACE_ID(tr) < t->t_nid);		\
+			el = arena_slot(&a, TRACE_ID(tr));		\
+			if (!onq[el - elems])				\
+				break;					\
+			bench_pmu_start(pc);				\
+			s = bench_now();				\
+			kind##_REMOVE(name, head, el);			\
+			bench_hist_add(&st->rem, bench_since(s));	\
+			bench_pmu_stop(pc, st->rem_pmu);		\
+			onq[el - elems] = 0;				\
+			break;						\
+		case TRACE_TICK:					\
+			for (n = tr->tr_key; n > 0; n--) {		\
+				now++;					\
+				while ((el = kind##_FIRST(head)) != NULL &&\
+				    el->val <= now) {			\
+					bench_pmu_start(pc);		\
+					s = bench_now();		\
+					kind##_REMOVE_HEAD(name, head);	\
+					bench_hist_add(&st->rem, bench_since(s));\
+					bench_pmu_stop(pc, st->rem_pmu);\
+					onq[el - elems] = 0;		\
+				}					\
+			}						\
+			break;						\
+		}							\
+	}								\
+	st->rss = rss() - r;						\
+	while (kind##_FIRST(head) != NULL)				\
+		kind##_REMOVE_HEAD(name, head);				\
+	fini(kind, name, head);						\
+	free(onq);							\
+	arena_fini(&a);							\
+}
+
+#define init_head(kind, head, elems) kind##_INIT(head)
+#define init_pool(kind, head, elems) kind##_INIT(head, elems)
+#define fini_none(kind, name, head)
+#define fini_head(kind, name, head) kind##_FREE(name, head)
+
+RUN_GENERATE(PHEAP, ph, init_head, fini_none, el_cmp)
+RUN_GENERATE_HEADONLY(HEAP, hh, init_head, fini_none, el_cmp)
+RUN_GENERATE(CHEAP, ch, init_head, fini_none, el_cmp)
+RUN_GENERATE(IHEAP, ih, init_pool, fini_none, el_cmp)
+RUN_GENERATE(AHEAP, ah, init_head, fini_head, el_cmp)
+RUN_GENERATE(DHEAP, dh2, init_head, fini_head, el_cmp, 2)
+RUN_GENERATE(DHEAP, dh4, init_head, fini_head, el_cmp, 4)
+RUN_GENERATE(DHEAP, dh8, init_head, fini_head, el_cmp, 8)
+RUN_GENERATE(KDHEAP, kdh4, init_head, fini_head, el_key, 4)
+RUN_GENERATE(KDHEAP, kdh8, init_head, fini_head, el_key, 8)
+
+#ifndef nitems
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+#endif
+
+/* The element sizes, -P picks one. */
+int payloads[] = { 16, 64, 256 };
+#define NPAYLOAD 3
+int payload;
+
+struct variant {
+	const char *name;
+	void (*run[NPAYLOAD])(int, struct opstats *);
+	void (*replay[NPAYLOAD])(const struct trace *, struct opstats *);
+} variants[] = {
+#define VARIANT(n, name) { n,						\
+	{ run_##name##16, run_##name##64, run_##name##256 },		\
+	{ replay_##name##16, replay_##name##64, replay_##name##256 } }
+#define VARIANT_HEADONLY(n, name) { n,					\
+	{ run_##name##16, run_##name##64, run_##name##256 },		\
+	{ NULL, NULL, NULL } }
+	VARIANT("pheap", ph),
+	VARIANT_HEADONLY("heap", hh),
+	VARIANT("cheap", ch),
+	VARIANT("iheap", ih),
+	VARIANT("aheap", ah),
+	VARIANT("dheap2", dh2),
+	VARIANT("dheap4", dh4),
+	VARIANT("dheap8", dh8),
+	VARIANT("kdheap4", kdh4),
+	VARIANT("kdheap8", kdh8),
+};
+
+static void
+print_tail(const struct bench_hist *h)
+{
+	printf(" %f %f %f %f %f",
+	    bench_ns(bench_hist_pct(h, 50)), bench_ns(bench_hist_pct(h, 90)),
+	    bench_ns(bench_hist_pct(h, 99)), bench_ns(bench_hist_pct(h, 99.9)),
+	    bench_ns(h->max));
+}
+
+/* A replay can have no updates or removes at all, that's a 0. */
+static double
+mean(double sum, uint64_t count)
+{
+	return count ? sum / count : 0;
+}
+
+static void
+print_pmu(const uint64_t *acc, uint64_t count)
+{
+	int i;
+
+	for (i = 0; i < bench_pmu_n; i++)
+		printf(" %f", mean(acc[i], count));
+}
+
+/*
+ * nelem, the mean ns of insert, update, remove, bytes per element and
+ * then p50 p90 p99 p99.9 max of insert, update and remove. With -e the
+ * mean of every counter per insert, update and remove follows, in the
+ * order they were given.
+ */
+static void
+print_stats(int nelem, struct opstats *st)
+{
+	printf("%d %f %f %f %f", nelem, mean(bench_ns(st->ins.sum), st->ins.count), mean(bench_ns(st->upd.sum), st->upd.count), mean(bench_ns(st->rem.sum), st->rem.count), (double)st->rss / nelem);
+	print_tail(&st->ins);
+	print_tail(&st->upd);
+	print_tail(&st->rem);
+	print_pmu(st->ins_pmu, st->ins.count);
+	print_pmu(st->upd_pmu, st->upd.count);
+	print_pmu(st->rem_pmu, st->rem.count);
+	printf("\n");
+	fflush(stdout);
+}
+
 void
-run_one(int nelem)
+run_one(const struct variant *v, int nelem)
 {
-	struct el *elems;
-	struct el *el;
-	int lowest = 0;
-	uint64_t s;
-	uint64_t it, ut, rt;
-	int inserts, updates, removes;
-	int added;
+	struct opstats st;
+
+	memset(&st, 0, sizeof(st));
+	v->run[payload](nelem, &st);
+	print_stats(nelem, &st);
+}
+
+/*
+ * Every variant on the same size, nelem and then a group of three
+ * columns per variant in the order of variants[]: the mean ns of
+ * insert, update and remove. No memory use, the variants after the
+ * first reuse the memory of the ones before.
+ */
+void
+matrix_one(const struct variant *unused, int nelem)
+{
+	struct opstats st;
+	int i;
+
+	printf("%d", nelem);
+	for (i = 0; i < nitems(variants); i++) {
+		memset(&st, 0, sizeof(st));
+		variants[i].run[payload](nelem, &st);
+		printf(" %f %f %f", mean(bench_ns(st.ins.sum), st.ins.count),
+		    mean(bench_ns(st.upd.sum), st.upd.count),
+		    mean(bench_ns(st.rem.sum), st.rem.count));
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/*
+ * The same columns as run_one after the name of the variant, nelem is
+ * the number of elements in the trace.
+ */
+void
+replay_one(const struct variant *v, const struct trace *t)
+{
+	struct opstats st;
+
+	if (v->replay[payload] == NULL)
+		return;
+	memset(&st, 0, sizeof(st));
+	v->replay[payload](t, &st);
+	printf("%s ", v->name);
+	print_stats(t->t_nid, &st);
+}
+
+/*
+ * Cold start. nelem inserts into an empty heap against one BUILD of
+ * the same elements, for HEAP and CHEAP.
+ */
+void
+build_one(const struct variant *v, int nelem)
+{
+	struct el *elems, **items;
+	uint64_t s, hi, hb, ci, cb;
+	int i;
 
 	if ((elems = calloc(nelem, sizeof(*elems))) == NULL)
 		err(1, "calloc");
+	if ((items = calloc(nelem, sizeof(*items))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < nelem; i++) {
+		elems[i].val = bench_random_uniform(nelem);
+		items[i] = &elems[i];
+	}
 
-	PHEAP_INIT(&heap_root);
-	inserts = updates = removes = 0;
-	it = ut = rt = 0;
-
-	added = 0;
-	while (added < nelem || PHEAP_FIRST(&heap_root)) {
-		switch (arc4random_uniform(10)) {
-		case 0:
-		case 1:
-		case 2:
-		case 3:
-		case 4:
-		case 5:
-			if (added < nelem) {
-				el = &elems[added++];
-				el->val = lowest + arc4random_uniform(nelem);
-				s = timestamp();
-				PHEAP_INSERT(h, &heap_root, el);
-				it += timestamp() - s;
-				inserts++;
-			}
-			break;
-		case 6:
-		case 7:
-			if ((el = PHEAP_FIRST(&heap_root)) != NULL) {
-				el->val = lowest + arc4random_uniform(10);
-				s = timestamp();
-				PHEAP_UPDATE_HEAD(h, &heap_root);
-				ut += timestamp() - s;
-				updates++;
-			}
-			break;
-		case 8:
-		case 9:
-			if ((el = PHEAP_FIRST(&heap_root)) != NULL) {
-				assert(lowest <= el->val);
-				lowest = el->val;
-				s = timestamp();
-				PHEAP_REMOVE_HEAD(h, &heap_root);
-				rt += timestamp() - s;
-				removes++;
-			}
-			break;
-		}
+	HEAP_INIT(&hh_root);
+	s = bench_now();
+	for (i = 0; i < nelem; i++)
+		HEAP_INSERT(hh, &hh_root, items[i]);
+	hi = bench_since(s);
+
+	s = bench_now();
+	HEAP_BUILD(hh, &hh_root, items, nelem);
+	hb = bench_since(s);
+
+	for (i = 0; HEAP_FIRST(&hh_root) != NULL; HEAP_REMOVE_HEAD(hh, &hh_root)) {
+		assert(i <= HEAP_FIRST(&hh_root)->val);
+		i = HEAP_FIRST(&hh_root)->val;
 	}
 
-	printf("%d %f %f %f\n", nelem, ts2ns(it) / inserts, ts2ns(ut) / updates, ts2ns(rt) / removes);
+	CHEAP_INIT(&ch_root);
+	s = bench_now();
+	for (i = 0; i < nelem; i++)
+		CHEAP_INSERT(ch, &ch_root, items[i]);
+	ci = bench_since(s);
+
+	s = bench_now();
+	CHEAP_BUILD(ch, &ch_root, items, nelem);
+	cb = bench_since(s);
+
+	for (i = 0; CHEAP_FIRST(&ch_root) != NULL; CHEAP_REMOVE_HEAD(ch, &ch_root)) {
+		assert(i <= CHEAP_FIRST(&ch_root)->val);
+		i = CHEAP_FIRST(&ch_root)->val;
+	}
+
+	printf("%d %f %f %f %f\n", nelem, bench_ns(hi) / nelem, bench_ns(hb) / nelem, bench_ns(ci) / nelem, bench_ns(cb) / nelem);
 	fflush(stdout);
+	free(items);
 	free(elems);
 }
 
-#ifndef nitems
-#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
-#endif
 int tests[] = {
 	10, 20, 50, 100, 200, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000
 };
 
+static void
+usage(void)
+{
+	int i;
+
+	fprintf(stderr, "usage: heap_test [-bm] [-e counters] [-M mem] [-P 16|64|256] [-r trace] [-S simdlevel] [-s seed]\n    [-T timer] [-t variant] [nelem]\nvariants:");
+	for (i = 0; i < nitems(variants); i++)
+		fprintf(stderr, " %s", variants[i].name);
+	fprintf(stderr, "\ncounters: %s\nmem: thp,hugetlb,shuffle,node=N\n", bench_pmu_list);
+	exit(1);
+}
+
 int
 main(int argc, char **argv)
 {
-	int i;
+	const struct variant *v = &variants[0];
+	void (*one)(const struct variant *, int) = run_one;
+	const char *timer = NULL, *trace = NULL, *counters = NULL;
+	struct trace t;
+	int i, ch, vset = 0;
+
+	while ((ch = getopt(argc, argv, "be:mM:P:r:S:s:T:t:")) != -1) {
+		switch (ch) {
+		case 'b':
+			one = build_one;
+			break;
+		case 'e':
+			counters = optarg;
+			break;
+		case 'm':
+			one = matrix_one;
+			break;
+		case 'M':
+			if (arena_parse(optarg, &arena_flags, &arena_node) == -1)
+				usage();
+			break;
+		case 'P':
+			for (i = 0; i < NPAYLOAD; i++)
+				if (payloads[i] == atoi(optarg))
+					break;
+			if (i == NPAYLOAD)
+				usage();
+			payload = i;
+			break;
+		case 'r':
+			trace = optarg;
+			break;
+		case 'S':
+			/* 0 scalar, 1 SSE4.1, 2 AVX2 in the keyed heaps. */
+			heap_simd_level = atoi(optarg);
+			break;
+		case 's':
+			bench_seed(strtoull(optarg, NULL, 0));
+			break;
+		case 'T':
+			timer = optarg;
+			break;
+		case 't':
+			for (i = 0; i < nitems(variants); i++)
+				if (!strcmp(optarg, variants[i].name))
+					break;
+			if (i == nitems(variants))
+				usage();
+			v = &variants[i];
+			vset = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (bench_timer_init(timer) == -1)
+		errx(1, "timer %s not available", timer);
+	if (counters != NULL && bench_pmu_init(counters) == -1)
+		usage();
+
+	/* A trace goes to the chosen variant, or all of them. */
+	if (trace != NULL) {
+		if (vset && v->replay[payload] == NULL)
+			errx(1, "%s can't replay a trace", v->name);
+		if (trace_open(&t, trace) == -1)
+			err(1, "%s", trace);
+		for (i = 0; i < nitems(variants); i++)
+			if (!vset || v == &variants[i])
+				replay_one(&variants[i], &t);
+		trace_close(&t);
+		return 0;
+	}
+
+	if (one == matrix_one) {
+		printf("# nelem, then insert update remove of");
+		for (i = 0; i < nitems(variants); i++)
+			printf(" %s", variants[i].name);
+		printf("\n");
+	}
 
-	if (argc == 2) {
-		run_one(atoi(argv[1]));
+	if (argc == 1) {
+		one(v, atoi(argv[0]));
 		return 0;
 	}
 
@@ -157,7 +595,7 @@ main(int argc, char **argv)
 		int steps = distance > 20 ? 20 : distance;
 		int j;
 		for (j = 0; j < steps; j++) {
-			run_one(((tests[i + 1] - tests[i]) / steps) * j + tests[i]);
+			one(v, ((tests[i + 1] - tests[i]) / steps) * j + tests[i]);
 		}
 	}
 
@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2006 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MTHEAP_H
+#define MTHEAP_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "heap.h"
+
+/*
+ * Priority queues for many threads, built out of the single threaded
+ * heaps in heap.h.
+ *
+ * MQHEAP implements INSERT, REMOVE, REMOVE_MIN.
+ * SHEAP implements INSERT, REMOVE, UPDATE, FIRST, CHECK.
+ */
+
+#define MTHEAP_CACHELINE 64
+
+/*
+ * The locks are pthread mutexes unless the user says otherwise.
+ * MTHEAP_TRYLOCK returns 0 when it got the lock.
+ */
+#ifndef MTHEAP_LOCK_T
+#define MTHEAP_LOCK_T pthread_mutex_t
+#define MTHEAP_LOCK_INIT(l) pthread_mutex_init(l, NULL)
+#define MTHEAP_LOCK_DESTROY(l) pthread_mutex_destroy(l)
+#define MTHEAP_LOCK(l) pthread_mutex_lock(l)
+#define MTHEAP_TRYLOCK(l) pthread_mutex_trylock(l)
+#define MTHEAP_UNLOCK(l) pthread_mutex_unlock(l)
+#endif
+
+/*
+ * Cheap per thread random numbers for picking queues.
+ */
+static inline uint32_t
+mtheap_random(void)
+{
+	static __thread uint32_t x;
+
+	if (x == 0)
+		x = (uint32_t)(uintptr_t)&x | 1;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+/*
+ * A small number for every thread, in the order they first asked.
+ */
+static inline unsigned int
+mtheap_thread(void)
+{
+	static unsigned int next;
+	static __thread unsigned int me;
+
+	if (me == 0)
+		me = __atomic_add_fetch(&next, 1, __ATOMIC_RELAXED);
+	return me - 1;
+}
+
+/*
+ * MQHEAP is a relaxed priority queue (a "MultiQueue"). It's an array of
+ * CHEAPs, each behind its own lock. INSERT puts the element in a random
+ * queue, REMOVE_MIN looks at the smallest element of two random queues
+ * and takes the smaller of them. So REMOVE_MIN does not return the
+ * smallest element in the whole structure, but one that's close to it,
+ * with more queues than threads there's almost never any contention on
+ * the locks.
+ *
+ * Every element remembers which queue it's on, so REMOVE of an arbitrary
+ * element only locks that queue. REMOVE returns 0 if the element was
+ * already taken by a REMOVE_MIN in some other thread. The key of an
+ * element may only be changed while it's not on the queue, updating is
+ * a REMOVE followed by an INSERT.
+ *
+ * The smallest element of every queue is published in mq_top so that
+ * REMOVE_MIN can pick a queue without locking, this means that the
+ * elements must stay around for as long as the queue is in use.
+ */
+#define MQHEAP_HEAD(name, type)						\
+CHEAP_HEAD(name##_ch, type);						\
+struct name##_q {							\
+	MTHEAP_LOCK_T mq_lock;						\
+	struct name##_ch mq_heap;					\
+	type *mq_top;							\
+} __attribute__((__aligned__(MTHEAP_CACHELINE)));			\
+struct name {								\
+	struct name##_q *mq_q;						\
+	unsigned int mq_nq;						\
+}
+
+#define MQHEAP_ENTRY(type)						\
+	struct {							\
+		CHEAP_ENTRY(type) mq_he;				\
+		int mq_idx;						\
+	}
+
+#define MQHEAP_INIT(name, head, nq) name##_MQ_INIT(head, nq)
+#define MQHEAP_DESTROY(name, head) name##_MQ_DESTROY(head)
+#define MQHEAP_ELEM_INIT(el, field) ((el)->field.mq_idx = -1)
+#define MQHEAP_ONQUEUE(el, field) (__atomic_load_n(&(el)->field.mq_idx, __ATOMIC_RELAXED) != -1)
+#define MQHEAP_INSERT(name, head, item) name##_MQ_INSERT(head, item)
+#define MQHEAP_REMOVE(name, head, item) name##_MQ_REMOVE(head, item)
+#define MQHEAP_REMOVE_MIN(name, head) name##_MQ_REMOVE_MIN(head)
+
+#define MQHEAP_PROTOTYPE(name, type, field, cmp, funprefix)		\
+funprefix int name##_MQ_INIT(struct name *, unsigned int);		\
+funprefix void name##_MQ_DESTROY(struct name *);			\
+funprefix void name##_MQ_INSERT(struct name *, type *);			\
+funprefix int name##_MQ_REMOVE(struct name *, type *);			\
+funprefix type *name##_MQ_REMOVE_MIN(struct name *);
+
+#define MQHEAP_GENERATE(name, type, field, cmp, funprefix)		\
+CHEAP_PROTOTYPE(name##_ch, type, field.mq_he, cmp, static)		\
+CHEAP_GENERATE(name##_ch, type, field.mq_he, cmp, static)		\
+									\
+funprefix int								\
+name##_MQ_INIT(struct name *head, unsigned int nq)			\
+{									\
+	void *q;							\
+	unsigned int i;							\
+									\
+	if (posix_memalign(&q, MTHEAP_CACHELINE, nq * sizeof(*head->mq_q)))\
+		return -1;						\
+	head->mq_q = q;							\
+	head->mq_nq = nq;						\
+	for (i = 0; i < nq; i++) {					\
+		MTHEAP_LOCK_INIT(&head->mq_q[i].mq_lock);		\
+		CHEAP_INIT(&head->mq_q[i].mq_heap);			\
+		head->mq_q[i].mq_top = NULL;				\
+	}								\
+	return 0;							\
+}									\
+									\
+funprefix void								\
+name##_MQ_DESTROY(struct name *head)					\
+{									\
+	unsigned int i;							\
+									\
+	for (i = 0; i < head->mq_nq; i++)				\
+		MTHEAP_LOCK_DESTROY(&head->mq_q[i].mq_lock);		\
+	free(head->mq_q);						\
+	head->mq_q = NULL;						\
+}									\
+									\
+funprefix void								\
+name##_MQ_INSERT(struct name *head, type *el)				\
+{									\
+	struct name##_q *q;						\
+	unsigned int i;							\
+									\
+	for (;;) {							\
+		i = mtheap_random() % head->mq_nq;			\
+		q = &head->mq_q[i];					\
+		if (MTHEAP_TRYLOCK(&q->mq_lock) == 0)			\
+			break;						\
+	}								\
+	CHEAP_INSERT(name##_ch, &q->mq_heap, el);			\
+	__atomic_store_n(&el->field.mq_idx, (int)i, __ATOMIC_RELAXED);	\
+	__atomic_store_n(&q->mq_top, CHEAP_FIRST(&q->mq_heap), __ATOMIC_RELEASE);\
+	MTHEAP_UNLOCK(&q->mq_lock);					\
+}									\
+									\
+funprefix int								\
+name##_MQ_REMOVE(struct name *head, type *el)				\
+{									\
+	struct name##_q *q;						\
+	int i;								\
+									\
+	while ((i = __atomic_load_n(&el->field.mq_idx, __ATOMIC_RELAXED)) != -1) {\
+		q = &head->mq_q[i];					\
+		MTHEAP_LOCK(&q->mq_lock);				\
+		/* Someone may have taken it while we waited. */	\
+		if (el->field.mq_idx == i) {				\
+			CHEAP_REMOVE(name##_ch, &q->mq_heap, el);	\
+			__atomic_store_n(&el->field.mq_idx, -1, __ATOMIC_RELAXED);\
+			__atomic_store_n(&q->mq_top, CHEAP_FIRST(&q->mq_heap),\
+			    __ATOMIC_RELEASE);				\
+			MTHEAP_UNLOCK(&q->mq_lock);			\
+			return 1;					\
+		}							\
+		MTHEAP_UNLOCK(&q->mq_lock);				\
+	}								\
+	return 0;							\
+}									\
+									\
+funprefix type *							\
+name##_MQ_REMOVE_MIN(struct name *head)					\
+{									\
+	struct name##_q *q;						\
+	type *ti, *tj, *el;						\
+	unsigned int i, j, misses = 0;					\
+									\
+	for (;;) {							\
+		i = mtheap_random() % head->mq_nq;			\
+		j = mtheap_random() % head->mq_nq;			\
+		ti = __atomic_load_n(&head->mq_q[i].mq_top, __ATOMIC_ACQUIRE);\
+		tj = __atomic_load_n(&head->mq_q[j].mq_top, __ATOMIC_ACQUIRE);\
+		if (ti == NULL && tj == NULL) {				\
+			/*						\
+			 * After enough misses check if everything is	\
+			 * empty before trying again.			\
+			 */						\
+			if (++misses < head->mq_nq)			\
+				continue;				\
+			for (i = 0; i < head->mq_nq; i++)		\
+				if (__atomic_load_n(&head->mq_q[i].mq_top,\
+				    __ATOMIC_ACQUIRE) != NULL)		\
+					break;				\
+			if (i == head->mq_nq)				\
+				return NULL;				\
+			misses = 0;					\
+			continue;					\
+		}							\
+		if (ti == NULL || (tj != NULL && cmp(tj, ti) < 0))	\
+			i = j;						\
+		q = &head->mq_q[i];					\
+		if (MTHEAP_TRYLOCK(&q->mq_lock))			\
+			continue;					\
+		if ((el = CHEAP_FIRST(&q->mq_heap)) != NULL) {		\
+			CHEAP_REMOVE(name##_ch, &q->mq_heap, el);	\
+			__atomic_store_n(&el->field.mq_idx, -1, __ATOMIC_RELAXED);\
+			__atomic_store_n(&q->mq_top, CHEAP_FIRST(&q->mq_heap),\
+			    __ATOMIC_RELEASE);				\
+		}							\
+		MTHEAP_UNLOCK(&q->mq_lock);				\
+		if (el != NULL)						\
+			return el;					\
+	}								\
+}
+
+/*
+ * SHEAP is a sharded heap. It's an array of CHEAPs, one per thread or cpu,
+ * each with its own lock, and a tournament tree over the smallest
+ * element of every shard. INSERT puts the element in the shard picked by
+ * the shard function given to the generator, REMOVE and UPDATE go to the
+ * shard the element is on. The tournament tree is only touched, under
+ * its own lock, when the smallest element of a shard changes. FIRST just
+ * reads the root of the tournament tree and doesn't lock anything.
+ *
+ * Unlike MQHEAP this is a real priority queue, FIRST is the smallest
+ * element as long as nothing is changing concurrently. It may be stale
+ * while other threads are changing the heap, so whoever wants to take
+ * the first element must REMOVE it and check the return value, 0 means
+ * that someone else took it first.
+ *
+ * The key of an element on the heap belongs to the heap, other threads
+ * compare against it under the shard lock at any time. It may only
+ * change while the element is not on the heap, or inside UPDATE, which
+ * calls set(el, arg) with the locks held to change it. UPDATE must not
+ * race with other operations on the same element.
+ *
+ * SHEAP_TREE_LOCK keeps the tournament tree from changing, so FIRST
+ * stays on the heap until SHEAP_TREE_UNLOCK. Nothing else on the heap
+ * may be done while holding it.
+ *
+ * The tree has a power of two number of leaves, sh_tree[n + i] is the
+ * smallest element of shard i, sh_tree[1] the smallest of all. The
+ * keys of the elements in the tree are read under the tree lock, so
+ * UPDATE of the first element of a shard changes its key under both.
+ *
+ * CHECK asserts that all the shards and the tree are in order and
+ * returns the number of elements, nothing else may run at the time.
+ */
+#define SHEAP_HEAD(name, type)						\
+CHEAP_HEAD(name##_ch, type);						\
+struct name##_shard {							\
+	MTHEAP_LOCK_T sh_lock;						\
+	struct name##_ch sh_heap;					\
+} __attribute__((__aligned__(MTHEAP_CACHELINE)));			\
+struct name {								\
+	struct name##_shard *sh_shard;					\
+	type **sh_tree;							\
+	unsigned int sh_n;						\
+	MTHEAP_LOCK_T sh_tlock;						\
+}
+
+#define SHEAP_ENTRY(type) MQHEAP_ENTRY(type)
+
+#define SHEAP_INIT(name, head, n) name##_SH_INIT(head, n)
+#define SHEAP_DESTROY(name, head) name##_SH_DESTROY(head)
+#define SHEAP_ELEM_INIT(el, field) MQHEAP_ELEM_INIT(el, field)
+#define SHEAP_ONQUEUE(el, field) MQHEAP_ONQUEUE(el, field)
+#define SHEAP_FIRST(head) __atomic_load_n(&(head)->sh_tree[1], __ATOMIC_ACQUIRE)
+#define SHEAP_EMPTY(head) (SHEAP_FIRST(head) == NULL)
+#define SHEAP_TREE_LOCK(head) MTHEAP_LOCK(&(head)->sh_tlock)
+#define SHEAP_TREE_UNLOCK(head) MTHEAP_UNLOCK(&(head)->sh_tlock)
+#define SHEAP_INSERT(name, head, item) name##_SH_INSERT(head, item)
+#define SHEAP_REMOVE(name, head, item) name##_SH_REMOVE(head, item)
+#define SHEAP_UPDATE(name, head, item, set, arg) name##_SH_UPDATE(head, item, set, arg)
+#define SHEAP_CHECK(name, head) name##_SH_CHECK(head)
+
+#define SHEAP_PROTOTYPE(name, type, field, cmp, shardfn, funprefix)	\
+funprefix int name##_SH_INIT(struct name *, unsigned int);		\
+funprefix void name##_SH_DESTROY(struct name *);			\
+funprefix void name##_SH_INSERT(struct name *, type *);			\
+funprefix int name##_SH_REMOVE(struct name *, type *);			\
+funprefix void name##_SH_UPDATE(struct name *, type *,			\
+    void (*)(type *, void *), void *);					\
+funprefix void name##_SH_REPLAY(struct name *, unsigned int);		\
+funprefix unsigned long name##_SH_CHECK(struct name *);
+
+#define SHEAP_GENERATE(name, type, field, cmp, shardfn, funprefix)	\
+CHEAP_PROTOTYPE(name##_ch, type, field.mq_he, cmp, static)		\
+CHEAP_GENERATE(name##_ch, type, field.mq_he, cmp, static)		\
+									\
+funprefix int								\
+name##_SH_INIT(struct name *head, unsigned int nshards)			\
+{									\
+	void *sh;							\
+	unsigned int i, n;						\
+									\
+	for (n = 1; n < nshards; n <<= 1)				\
+		;							\
+	if (posix_memalign(&sh, MTHEAP_CACHELINE, n * sizeof(*head->sh_shard)))\
+		return -1;						\
+	if ((head->sh_tree = calloc(2 * n, sizeof(type *))) == NULL) {	\
+		free(sh);						\
+		return -1;						\
+	}								\
+	head->sh_shard = sh;						\
+	head->sh_n = n;							\
+	for (i = 0; i < n; i++) {					\
+		MTHEAP_LOCK_INIT(&head->sh_shard[i].sh_lock);		\
+		CHEAP_INIT(&head->sh_shard[i].sh_heap);			\
+	}								\
+	MTHEAP_LOCK_INIT(&head->sh_tlock);				\
+	return 0;							\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_SH_DESTROY(struct name *head)					\
+{									\
+	unsigned int i;							\
+									\
+	for (i = 0; i < head->sh_n; i++)				\
+		MTHEAP_LOCK_DESTROY(&head->sh_shard[i].sh_lock);	\
+	MTHEAP_LOCK_DESTROY(&head->sh_tlock);				\
+	free(head->sh_shard);						\
+	free(head->sh_tree);						\
+}									\
+									\
+/*									\
+ * Replay the tournament from shard i up. Called with the shard locked.	\
+ */									\
+funprefix void								\
+name##_SH_REPLAY(struct name *head, unsigned int i)			\
+{									\
+	type **t = head->sh_tree;					\
+	type *a, *b;							\
+	unsigned int n;							\
+									\
+	MTHEAP_LOCK(&head->sh_tlock);					\
+	n = head->sh_n + i;						\
+	t[n] = CHEAP_FIRST(&head->sh_shard[i].sh_heap);			\
+	for (; n > 1; n >>= 1) {					\
+		a = t[n & ~1U];						\
+		b = t[n | 1];						\
+		if (a == NULL || (b != NULL && cmp(b, a) < 0))		\
+			a = b;						\
+		__atomic_store_n(&t[n >> 1], a, __ATOMIC_RELEASE);	\
+	}								\
+	MTHEAP_UNLOCK(&head->sh_tlock);					\
+}									\
+									\
+funprefix void								\
+name##_SH_INSERT(struct name *head, type *el)				\
+{									\
+	unsigned int i = (shardfn()) & (head->sh_n - 1);		\
+	struct name##_shard *sh = &head->sh_shard[i];			\
+									\
+	MTHEAP_LOCK(&sh->sh_lock);					\
+	CHEAP_INSERT(name##_ch, &sh->sh_heap, el);			\
+	__atomic_store_n(&el->field.mq_idx, (int)i, __ATOMIC_RELAXED);	\
+	if (CHEAP_FIRST(&sh->sh_heap) == el)				\
+		name##_SH_REPLAY(head, i);				\
+	MTHEAP_UNLOCK(&sh->sh_lock);					\
+}									\
+									\
+funprefix int								\
+name##_SH_REMOVE(struct name *head, type *el)				\
+{									\
+	struct name##_shard *sh;					\
+	int i;								\
+									\
+	while ((i = __atomic_load_n(&el->field.mq_idx, __ATOMIC_RELAXED)) != -1) {\
+		sh = &head->sh_shard[i];				\
+		MTHEAP_LOCK(&sh->sh_lock);				\
+		if (el->field.mq_idx == i) {				\
+			int first = CHEAP_FIRST(&sh->sh_heap) == el;	\
+			CHEAP_REMOVE(name##_ch, &sh->sh_heap, el);	\
+			__atomic_store_n(&el->field.mq_idx, -1, __ATOMIC_RELAXED);\
+			if (first)					\
+				name##_SH_REPLAY(head, i);		\
+			MTHEAP_UNLOCK(&sh->sh_lock);			\
+			return 1;					\
+		}							\
+		MTHEAP_UNLOCK(&sh->sh_lock);				\
+	}								\
+	return 0;							\
+}									\
+									\
+HEAP_UNUSED funprefix void						\
+name##_SH_UPDATE(struct name *head, type *el,				\
+    void (*set)(type *, void *), void *arg)				\
+{									\
+	int i = __atomic_load_n(&el->field.mq_idx, __ATOMIC_RELAXED);	\
+	struct name##_shard *sh = &head->sh_shard[i];			\
+	type *first;							\
+									\
+	MTHEAP_LOCK(&sh->sh_lock);					\
+	first = CHEAP_FIRST(&sh->sh_heap);				\
+	if (first == el) {						\
+		MTHEAP_LOCK(&head->sh_tlock);				\
+		set(el, arg);						\
+		MTHEAP_UNLOCK(&head->sh_tlock);				\
+	} else {							\
+		set(el, arg);						\
+	}								\
+	CHEAP_UPDATE(name##_ch, &sh->sh_heap, el);			\
+	if (first == el || CHEAP_FIRST(&sh->sh_heap) != first)		\
+		name##_SH_REPLAY(head, i);				\
+	MTHEAP_UNLOCK(&sh->sh_lock);					\
+}									\
+									\
+HEAP_UNUSED funprefix unsigned long					\
+name##_SH_CHECK(struct name *head)					\
+{									\
+	type **t = head->sh_tree;					\
+	type *a, *b;							\
+	unsigned long num = 0;						\
+	unsigned int i;							\
+									\
+	for (i = 0; i < head->sh_n; i++) {				\
+		CHEAP_CHECK(name##_ch, &head->sh_shard[i].sh_heap);	\
+		assert(t[head->sh_n + i] ==				\
+		    CHEAP_FIRST(&head->sh_shard[i].sh_heap));		\
+		num += head->sh_shard[i].sh_heap.hh_num;		\
+	}								\
+	for (i = head->sh_n - 1; i > 0; i--) {				\
+		a = t[2 * i];						\
+		b = t[2 * i + 1];					\
+		assert(t[i] == a || t[i] == b);				\
+		assert(t[i] != NULL || (a == NULL && b == NULL));	\
+		assert(t[i] == NULL || a == NULL || cmp(t[i], a) <= 0);	\
+		assert(t[i] == NULL || b == NULL || cmp(t[i], b) <= 0);	\
+	}								\
+	return num;							\
+}
+
+#endif /*MTHEAP_H*/
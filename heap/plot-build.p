@@ -0,0 +1,11 @@
+set autoscale
+set xtic auto
+set ytic auto
+set ylabel "time per element (ns)"
+set yrange [0:]
+set xlabel "elements"
+#set logscale x
+plot "test-build.out" using 1:2 title "heap inserts" with lines, \
+     "test-build.out" using 1:3 title "heap build" with lines, \
+     "test-build.out" using 1:4 title "cheap inserts" with lines, \
+     "test-build.out" using 1:5 title "cheap build" with lines
@@ -0,0 +1,20 @@
+set autoscale
+set xtic auto
+set ytic auto
+set ylabel "time per event (ns)"
+set yrange [0:]
+set xlabel "elements"
+#set logscale x
+plot "test-dheap2.out" using 1:2 title "2 insert" with lines, \
+     "test-dheap2.out" using 1:3 title "2 update" with lines, \
+     "test-dheap2.out" using 1:4 title "2 remove" with lines, \
+     "test-dheap4.out" using 1:2 title "4 insert" with lines, \
+     "test-dheap4.out" using 1:3 title "4 update" with lines, \
+     "test-dheap4.out" using 1:4 title "4 remove" with lines, \
+     "test-dheap8.out" using 1:2 title "8 insert" with lines, \
+     "test-dheap8.out" using 1:3 title "8 update" with lines, \
+     "test-dheap8.out" using 1:4 title "8 remove" with lines, \
+     "test-kdheap8.out" using 1:3 title "8 simd update" with lines, \
+     "test-kdheap8.out" using 1:4 title "8 simd remove" with lines, \
+     "test-kdheap8-scalar.out" using 1:3 title "8 key update" with lines, \
+     "test-kdheap8-scalar.out" using 1:4 title "8 key remove" with lines
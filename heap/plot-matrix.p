@@ -0,0 +1,19 @@
+set autoscale
+set xtic auto
+set ytic auto
+set ylabel "time per remove (ns)"
+set yrange [0:]
+set xlabel "elements"
+set logscale x
+# Three columns per variant after nelem, remove is the third.
+file = "test-matrix-64.out"
+plot file using 1:4 title "pheap" with lines, \
+     file using 1:7 title "heap" with lines, \
+     file using 1:10 title "cheap" with lines, \
+     file using 1:13 title "iheap" with lines, \
+     file using 1:16 title "aheap" with lines, \
+     file using 1:19 title "dheap2" with lines, \
+     file using 1:22 title "dheap4" with lines, \
+     file using 1:25 title "dheap8" with lines, \
+     file using 1:28 title "kdheap4" with lines, \
+     file using 1:31 title "kdheap8" with lines
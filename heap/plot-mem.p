@@ -0,0 +1,12 @@
+set autoscale
+set xtic auto
+set ytic auto
+set ylabel "resident bytes per element"
+set yrange [0:]
+set xlabel "elements"
+set logscale x
+plot "test.out" using 1:5 title "pheap" with lines, \
+     "test-cheap.out" using 1:5 title "cheap" with lines, \
+     "test-iheap.out" using 1:5 title "iheap" with lines, \
+     "test-aheap.out" using 1:5 title "aheap" with lines, \
+     "test-dheap4.out" using 1:5 title "dheap4" with lines
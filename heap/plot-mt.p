@@ -0,0 +1,10 @@
+set autoscale
+set xtic auto
+set ytic auto
+set ylabel "operations per second"
+set yrange [0:]
+set xlabel "threads"
+set logscale x 2
+plot "test-mt.out" using 1:2 title "locked cheap" with linespoints, \
+     "test-mt.out" using 1:3 title "multiqueue" with linespoints, \
+     "test-mt.out" using 1:4 title "sharded" with linespoints
@@ -8,6 +8,15 @@ set xlabel "elements"
 plot "test.out" using 1:2 title "insert" with lines, \
      "test.out" using 1:3 title "update" with lines, \
      "test.out" using 1:4 title "remove" with lines, \
+     "test.out" using 1:9 title "insert p99.9" with lines dt 2, \
+     "test.out" using 1:14 title "update p99.9" with lines dt 2, \
+     "test.out" using 1:19 title "remove p99.9" with lines dt 2, \
+     "test-aheap.out" using 1:2 title "aheap insert" with lines, \
+     "test-aheap.out" using 1:3 title "aheap update" with lines, \
+     "test-aheap.out" using 1:4 title "aheap remove" with lines, \
+     "test-iheap.out" using 1:2 title "iheap insert" with lines, \
+     "test-iheap.out" using 1:3 title "iheap update" with lines, \
+     "test-iheap.out" using 1:4 title "iheap remove" with lines, \
      "reference.out" using 1:2 title "ref insert" with lines, \
      "reference.out" using 1:3 title "ref update" with lines, \
      "reference.out" using 1:4 title "ref remove" with lines
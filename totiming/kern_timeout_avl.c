@@ -66,7 +66,38 @@ int tick;
 struct mutex timeout_mutex = MUTEX_INITIALIZER(IPL_HIGH);
 #endif
 
-struct avl_node *to_tree;
+struct avl_tree to_tree = AVL_TREE_INITIALIZER;
+
+/*
+ * softclock splits everything that is due off the tree in one go and
+ * strings it up on timeout_todo in order, the same list the wheel
+ * uses. A timeout there has TIMEOUT_TODO set so that deleting it
+ * knows where it is.
+ */
+struct circq timeout_todo;
+
+#define CIRCQ_INIT(elem) do {                   \
+        (elem)->next = (elem);                  \
+        (elem)->prev = (elem);                  \
+} while (0)
+
+#define CIRCQ_INSERT(elem, list) do {           \
+        (elem)->prev = (list)->prev;            \
+        (elem)->next = (list);                  \
+        (list)->prev->next = (elem);            \
+        (list)->prev = (elem);                  \
+} while (0)
+
+#define CIRCQ_REMOVE(elem) do {                 \
+        (elem)->next->prev = (elem)->prev;      \
+        (elem)->prev->next = (elem)->next;      \
+	_Q_INVALIDATE((elem)->prev);		\
+	_Q_INVALIDATE((elem)->next);		\
+} while (0)
+
+#define CIRCQ_FIRST(elem) ((elem)->next)
+
+#define CIRCQ_EMPTY(elem) (CIRCQ_FIRST(elem) == (elem))
 
 /*
  * Some of the "math" in here is a bit tricky.
@@ -86,19 +117,35 @@ extern int ticks;		/* XXX - move to sys/X.h */
 void
 timeout_startup(void)
 {
+	CIRCQ_INIT(&timeout_todo);
 }
 
-int
-t_cmp(const struct avl_node *an, const struct avl_node *bn)
+static inline int
+to_cmp(const struct timeout *a, const struct timeout *b)
 {
-	const struct timeout *a = avl_data(an, struct timeout, to_tree);
-	const struct timeout *b = avl_data(bn, struct timeout, to_tree);
-
 	if (a->to_time == b->to_time)
 		return (intptr_t)a - (intptr_t)b;
 	return a->to_time - b->to_time;
 }
 
+int
+t_cmp(const struct avl_node *an, const struct avl_node *bn)
+{
+	return to_cmp(avl_data(an, struct timeout, to_tree),
+	    avl_data(bn, struct timeout, to_tree));
+}
+
+/* Only the time, for splitting off everything before a tick. */
+static int
+t_time_cmp(const struct avl_node *an, const struct avl_node *bn)
+{
+	return avl_data(an, struct timeout, to_tree)->to_time -
+	    avl_data(bn, struct timeout, to_tree)->to_time;
+}
+
+AVL_PROTOTYPE(to, struct timeout, to_tree, to_cmp, static)
+AVL_GENERATE(to, struct timeout, to_tree, to_cmp, static)
+
 void
 timeout_set(struct timeout *new, void (*fn)(void *), void *arg)
 {
@@ -125,7 +172,7 @@ timeout_add(struct timeout *new, int to_ticks)
 	new->to_time = to_ticks + ticks;
 	new->to_flags &= ~TIMEOUT_TRIGGERED;
 	new->to_flags |= TIMEOUT_ONQUEUE;
-	avl_insert(&new->to_tree, &to_tree, t_cmp);
+	AVL_TREE_INSERT(to, &to_tree, new);
 	mtx_leave(&timeout_mutex);
 }
 
@@ -212,9 +259,12 @@ static int
 _timeout_del(struct timeout *to)
 {
 	int ret = 0;
+	if (to->to_flags & TIMEOUT_TODO)
+		CIRCQ_REMOVE(&to->to_list);
+	else if (to->to_flags & TIMEOUT_ONQUEUE)
+		AVL_TREE_DELETE(to, &to_tree, to);
 	if (to->to_flags & TIMEOUT_ONQUEUE) {
-		avl_delete(&to->to_tree, &to_tree, t_cmp);
-		to->to_flags &= ~TIMEOUT_ONQUEUE;
+		to->to_flags &= ~(TIMEOUT_ONQUEUE | TIMEOUT_TODO);
 		ret = 1;
 	}
 	to->to_flags &= ~TIMEOUT_TRIGGERED;
@@ -248,49 +298,58 @@ timeout_hardclock_update(void)
 }
 
 /*
- * Special compare for iterator.
- *
- * The 'b' node is always our iterator markers.
+ * Put the tree on timeout_todo in order. The list links are on top of
+ * the tree links, the right child is picked up before they go.
  */
-static int
-t_iter_cmp(struct avl_node *an, struct avl_node *bn)
+static void
+timeout_flatten(struct avl_node *n)
 {
-	struct timeout *a = avl_data(an, struct timeout, to_tree);
-	struct timeout *b = avl_data(bn, struct timeout, to_tree);
+	struct avl_node *r;
+	struct timeout *to;
 
-	if (a->to_time == b->to_time)
-		return (intptr_t)a;
-	return a->to_time - b->to_time;
+	while (n != NULL) {
+		timeout_flatten(n->link[0]);
+		r = n->link[1];
+		to = avl_data(n, struct timeout, to_tree);
+		to->to_flags |= TIMEOUT_TODO;
+		CIRCQ_INSERT(&to->to_list, &timeout_todo);
+		n = r;
+	}
 }
 
-
 void
 softclock(void *arg)
 {
+	struct avl_tree due = AVL_TREE_INITIALIZER;
 	struct avl_node *n;
 	struct timeout *to;
 	struct timeout s;
 	void (*fn)(void *);
 
-	s.to_time = -1;
-
 	mtx_enter(&timeout_mutex);
-	while ((n = avl_search(&s.to_tree, &to_tree, t_cmp)) && (to = avl_data(n, struct timeout, to_tree))->to_time - ticks <= 0) {
-		_timeout_del(to);
+	while ((n = avl_tree_min(&to_tree)) != NULL &&
+	    avl_data(n, struct timeout, to_tree)->to_time - ticks <= 0) {
+		s.to_time = ticks + 1;
+		avl_tree_split(&to_tree, &s.to_tree, t_time_cmp, &due);
+		timeout_flatten(due.root);
+
+		while (!CIRCQ_EMPTY(&timeout_todo)) {
+			to = (struct timeout *)CIRCQ_FIRST(&timeout_todo); /* XXX */
+			_timeout_del(to);
 #ifdef DEBUG
-		if (to->to_time - ticks < 0)
-			printf("timeout delayed %d\n", to->to_time -
-			    ticks);
+			if (to->to_time - ticks < 0)
+				printf("timeout delayed %d\n", to->to_time -
+				    ticks);
 #endif
-		to->to_flags &= ~TIMEOUT_ONQUEUE;
-		to->to_flags |= TIMEOUT_TRIGGERED;
+			to->to_flags |= TIMEOUT_TRIGGERED;
 
-		fn = to->to_func;
-		arg = to->to_arg;
+			fn = to->to_func;
+			arg = to->to_arg;
 
-		mtx_leave(&timeout_mutex);
-		fn(arg);
-		mtx_enter(&timeout_mutex);
+			mtx_leave(&timeout_mutex);
+			fn(arg);
+			mtx_enter(&timeout_mutex);
+		}
 	}
 	mtx_leave(&timeout_mutex);
 }
@@ -26,6 +26,7 @@
 
 #ifdef TEST_HARNESS
 #include <sys/time.h>
+#include <err.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <stdio.h>
@@ -53,6 +54,8 @@
  *
  * We need locking since the timeouts are manipulated from hardclock that's
  * not behind the big lock.
+ *
+ * Except with TIMEOUT_SHEAP, see below.
  */
 #ifdef TEST_HARNESS
 #define mtx_enter(m)
@@ -61,6 +64,7 @@ int hz = 100;
 int tick;
 #define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
 #define _Q_INVALIDATE(a) (a) = ((void *)-1)
+#define panic(...) errx(1, __VA_ARGS__)
 #else
 struct mutex timeout_mutex = MUTEX_INITIALIZER(IPL_HIGH);
 #endif
@@ -71,9 +75,116 @@ t_cmp(const struct timeout *a, const struct timeout *b)
 	return a->to_time - b->to_time;
 }
 
+/*
+ * The heap is a CHEAP by default. Define TIMEOUT_DHEAP to use a DHEAP
+ * with TIMEOUT_DHEAP_ARITY children per node instead.
+ */
+#ifdef TIMEOUT_DHEAP
+#ifndef TIMEOUT_DHEAP_ARITY
+#define TIMEOUT_DHEAP_ARITY 4
+#endif
+DHEAP_HEAD(timeoutheap, struct timeout) to_heap;
+DHEAP_PROTOTYPE(timeoutheap, struct timeout, to_dheap, t_cmp, TIMEOUT_DHEAP_ARITY, static)
+DHEAP_GENERATE(timeoutheap, struct timeout, to_dheap, t_cmp, TIMEOUT_DHEAP_ARITY, static)
+#define TOHEAP_FIRST(head) DHEAP_FIRST(head)
+#define TOHEAP_INSERT(head, to) do {					\
+	if (DHEAP_INSERT(timeoutheap, head, to))			\
+		panic("timeout_add: can't grow heap");			\
+} while (0)
+#define TOHEAP_REMOVE(head, to) DHEAP_REMOVE(timeoutheap, head, to)
+#define TOHEAP_UPDATE(head, to) DHEAP_UPDATE(timeoutheap, head, to)
+#define TOHEAP_INCREASE_KEY(head, to) TOHEAP_UPDATE(head, to)
+#define TOHEAP_DECREASE_KEY(head, to) TOHEAP_UPDATE(head, to)
+#elif defined(TIMEOUT_SHEAP)
+/*
+ * A sharded heap with one shard per cpu, there is no global lock on the
+ * heap and timeout_add and timeout_del only lock the shard the timeout
+ * is on. Instead of timeout_mutex every timeout is locked with its
+ * TIMEOUT_BUSY flag, which keeps two cpus from changing the same
+ * timeout at the same time. softclock finds the first timeout while
+ * holding the tournament tree lock so that it can't be freed under us.
+ *
+ * Lock order is TIMEOUT_BUSY, shard, tree. softclock takes the tree lock
+ * first so it only tries to get TIMEOUT_BUSY.
+ *
+ * Other cpus compare against to_time while the timeout is on the heap,
+ * so it's only changed there by SHEAP_UPDATE, which calls to_settime
+ * with the shard locked. to_flags is shared with the TIMEOUT_BUSY bit,
+ * every change to it is atomic.
+ *
+ * XXX - The shards need a lock type and an allocator for the kernel,
+ * this is only for the test harness for now.
+ */
+#ifndef TEST_HARNESS
+#error "TIMEOUT_SHEAP only works in the test harness"
+#endif
+#ifndef TIMEOUT_SHEAP_SHARDS
+#define TIMEOUT_SHEAP_SHARDS 8
+#endif
+#define cpu_number() mtheap_thread()
+SHEAP_HEAD(timeoutheap, struct timeout) to_heap;
+SHEAP_PROTOTYPE(timeoutheap, struct timeout, to_sheap, t_cmp, cpu_number, static)
+SHEAP_GENERATE(timeoutheap, struct timeout, to_sheap, t_cmp, cpu_number, static)
+#define TOHEAP_FIRST(head) SHEAP_FIRST(head)
+#define TOHEAP_INSERT(head, to) SHEAP_INSERT(timeoutheap, head, to)
+#define TOHEAP_REMOVE(head, to) SHEAP_REMOVE(timeoutheap, head, to)
+#define TOHEAP_SETTIME(head, to, t) do {				\
+	int _t = (t);							\
+	SHEAP_UPDATE(timeoutheap, head, to, to_settime, &_t);		\
+} while (0)
+
+static void
+to_settime(struct timeout *to, void *arg)
+{
+	to->to_time = *(int *)arg;
+}
+
+#define to_isset(to, f)	(__atomic_load_n(&(to)->to_flags, __ATOMIC_RELAXED) & (f))
+#define to_setflag(to, f) __atomic_fetch_or(&(to)->to_flags, (f), __ATOMIC_RELAXED)
+#define to_clrflag(to, f) __atomic_fetch_and(&(to)->to_flags, ~(f), __ATOMIC_RELAXED)
+
+static inline int
+to_trylock(struct timeout *to)
+{
+	return !(__atomic_fetch_or(&to->to_flags, TIMEOUT_BUSY,
+	    __ATOMIC_ACQUIRE) & TIMEOUT_BUSY);
+}
+
+#define to_lock(to)	do { } while (!to_trylock(to))
+#define to_unlock(to)	__atomic_fetch_and(&(to)->to_flags, ~TIMEOUT_BUSY, __ATOMIC_RELEASE)
+#else
 CHEAP_HEAD(timeoutheap, struct timeout) to_heap;
 CHEAP_PROTOTYPE(timeoutheap, struct timeout, to_heap, t_cmp, static)
 CHEAP_GENERATE(timeoutheap, struct timeout, to_heap, t_cmp, static)
+#define TOHEAP_FIRST(head) CHEAP_FIRST(head)
+#define TOHEAP_INSERT(head, to) CHEAP_INSERT(timeoutheap, head, to)
+#define TOHEAP_REMOVE(head, to) CHEAP_REMOVE(timeoutheap, head, to)
+#define TOHEAP_UPDATE(head, to) CHEAP_UPDATE(timeoutheap, head, to)
+#define TOHEAP_INCREASE_KEY(head, to) CHEAP_INCREASE_KEY(timeoutheap, head, to)
+#define TOHEAP_DECREASE_KEY(head, to) CHEAP_DECREASE_KEY(timeoutheap, head, to)
+#endif
+
+#ifndef TIMEOUT_SHEAP
+/*
+ * Most of the time a timeout that's already scheduled gets pushed
+ * further into the future, so it only has to move down.
+ */
+#define TOHEAP_SETTIME(head, to, t) do {				\
+	int _old = (to)->to_time;					\
+	(to)->to_time = (t);						\
+	if ((to)->to_time - _old >= 0)					\
+		TOHEAP_INCREASE_KEY(head, to);				\
+	else								\
+		TOHEAP_DECREASE_KEY(head, to);				\
+} while (0)
+
+#define to_isset(to, f)	((to)->to_flags & (f))
+#define to_setflag(to, f) ((to)->to_flags |= (f))
+#define to_clrflag(to, f) ((to)->to_flags &= ~(f))
+
+#define to_lock(to)	mtx_enter(&timeout_mutex)
+#define to_unlock(to)	mtx_leave(&timeout_mutex)
+#endif
 
 /*
  * Some of the "math" in here is a bit tricky.
@@ -93,6 +204,10 @@ extern int ticks;		/* XXX - move to sys/X.h */
 void
 timeout_startup(void)
 {
+#ifdef TIMEOUT_SHEAP
+	if (SHEAP_INIT(timeoutheap, &to_heap, TIMEOUT_SHEAP_SHARDS))
+		panic("timeout_startup: can't allocate shards");
+#endif
 }
 
 void
@@ -100,7 +215,7 @@ timeout_set(struct timeout *new, void (*fn)(void *), void *arg)
 {
 	new->to_func = fn;
 	new->to_arg = arg;
-	new->to_flags = TIMEOUT_INITIALIZED;
+	__atomic_store_n(&new->to_flags, TIMEOUT_INITIALIZED, __ATOMIC_RELAXED);
 }
 
 static int _timeout_del(struct timeout *);
@@ -109,22 +224,22 @@ void
 timeout_add(struct timeout *new, int to_ticks)
 {
 #ifdef DIAGNOSTIC
-	if (!(new->to_flags & TIMEOUT_INITIALIZED))
+	if (!to_isset(new, TIMEOUT_INITIALIZED))
 		panic("timeout_add: not initialized");
 	if (to_ticks < 0)
 		panic("timeout_add: to_ticks (%d) < 0", to_ticks);
 #endif
 
-	mtx_enter(&timeout_mutex);
-	new->to_time = to_ticks + ticks;
-	new->to_flags &= ~TIMEOUT_TRIGGERED;
-	if (new->to_flags & TIMEOUT_ONQUEUE) {
-		CHEAP_UPDATE(timeoutheap, &to_heap, new);
+	to_lock(new);
+	to_clrflag(new, TIMEOUT_TRIGGERED);
+	if (to_isset(new, TIMEOUT_ONQUEUE)) {
+		TOHEAP_SETTIME(&to_heap, new, to_ticks + ticks);
 	} else {
-		new->to_flags |= TIMEOUT_ONQUEUE;
-		CHEAP_INSERT(timeoutheap, &to_heap, new);
+		new->to_time = to_ticks + ticks;
+		to_setflag(new, TIMEOUT_ONQUEUE);
+		TOHEAP_INSERT(&to_heap, new);
 	}
-	mtx_leave(&timeout_mutex);
+	to_unlock(new);
 }
 
 void
@@ -210,12 +325,12 @@ static int
 _timeout_del(struct timeout *to)
 {
 	int ret = 0;
-	if (to->to_flags & TIMEOUT_ONQUEUE) {
-		CHEAP_REMOVE(timeoutheap, &to_heap, to);
-		to->to_flags &= ~TIMEOUT_ONQUEUE;
+	if (to_isset(to, TIMEOUT_ONQUEUE)) {
+		TOHEAP_REMOVE(&to_heap, to);
+		to_clrflag(to, TIMEOUT_ONQUEUE);
 		ret = 1;
 	}
-	to->to_flags &= ~TIMEOUT_TRIGGERED;
+	to_clrflag(to, TIMEOUT_TRIGGERED);
 	return ret;
 }
 
@@ -224,9 +339,9 @@ timeout_del(struct timeout *to)
 {
 	int ret;
 
-	mtx_enter(&timeout_mutex);
+	to_lock(to);
 	ret = _timeout_del(to);
-	mtx_leave(&timeout_mutex);
+	to_unlock(to);
 
 	return ret;
 }
@@ -240,14 +355,72 @@ timeout_hardclock_update(void)
 {
 	int ret;
 
+#ifdef TIMEOUT_SHEAP
+	struct timeout *to;
+
+	ticks++;
+	SHEAP_TREE_LOCK(&to_heap);
+	ret = (to = TOHEAP_FIRST(&to_heap)) ? to->to_time - ticks <= 0 : 0;
+	SHEAP_TREE_UNLOCK(&to_heap);
+#else
 	mtx_enter(&timeout_mutex);
 	ticks++;
-	ret = CHEAP_FIRST(&to_heap) ? CHEAP_FIRST(&to_heap)->to_time - ticks <= 0 : 0;
+	ret = TOHEAP_FIRST(&to_heap) ? TOHEAP_FIRST(&to_heap)->to_time - ticks <= 0 : 0;
 	mtx_leave(&timeout_mutex);
+#endif
 
 	return (ret);
 }
 
+#ifdef TIMEOUT_SHEAP
+/*
+ * Get the first timeout if it's due, with TIMEOUT_BUSY held.
+ */
+static struct timeout *
+softclock_first(void)
+{
+	struct timeout *to;
+
+	for (;;) {
+		SHEAP_TREE_LOCK(&to_heap);
+		if ((to = TOHEAP_FIRST(&to_heap)) == NULL ||
+		    to->to_time - ticks > 0) {
+			SHEAP_TREE_UNLOCK(&to_heap);
+			return NULL;
+		}
+		if (to_trylock(to)) {
+			SHEAP_TREE_UNLOCK(&to_heap);
+			return to;
+		}
+		SHEAP_TREE_UNLOCK(&to_heap);
+	}
+}
+
+void
+softclock(void *arg)
+{
+	struct timeout *to;
+	void (*fn)(void *);
+
+	while ((to = softclock_first()) != NULL) {
+		TOHEAP_REMOVE(&to_heap, to);
+		to_clrflag(to, TIMEOUT_ONQUEUE);
+		to_setflag(to, TIMEOUT_TRIGGERED);
+
+		fn = to->to_func;
+		arg = to->to_arg;
+
+		to_unlock(to);
+		fn(arg);
+	}
+}
+
+unsigned long
+timeout_check(void)
+{
+	return SHEAP_CHECK(timeoutheap, &to_heap);
+}
+#else
 void
 softclock(void *arg)
 {
@@ -255,15 +428,15 @@ softclock(void *arg)
 	void (*fn)(void *);
 
 	mtx_enter(&timeout_mutex);
-	while ((to = CHEAP_FIRST(&to_heap)) && to->to_time - ticks <= 0) {
-		CHEAP_REMOVE(timeoutheap, &to_heap, to);
+	while ((to = TOHEAP_FIRST(&to_heap)) && to->to_time - ticks <= 0) {
+		TOHEAP_REMOVE(&to_heap, to);
 #ifdef DEBUG
 		if (to->to_time - ticks < 0)
 			printf("timeout delayed %d\n", to->to_time -
 			    ticks);
 #endif
-		to->to_flags &= ~TIMEOUT_ONQUEUE;
-		to->to_flags |= TIMEOUT_TRIGGERED;
+		to_clrflag(to, TIMEOUT_ONQUEUE);
+		to_setflag(to, TIMEOUT_TRIGGERED);
 
 		fn = to->to_func;
 		arg = to->to_arg;
@@ -274,6 +447,7 @@ softclock(void *arg)
 	}
 	mtx_leave(&timeout_mutex);
 }
+#endif
 
 #ifdef DDB
 void db_show_callout_bucket(struct circq *);
@@ -13,4 +13,11 @@ plot "test.out" using 1:4 title "add" with lines, \
      "test-avl.out" using 1:6 title "avl fire" with lines, \
      "test-heap.out" using 1:4 title "heap add" with lines, \
      "test-heap.out" using 1:5 title "heap del" with lines, \
-     "test-heap.out" using 1:6 title "heap fire" with lines
+     "test-heap.out" using 1:6 title "heap fire" with lines, \
+     "test-heap.out" using 1:7 title "heap upd" with lines, \
+     "test-dheap.out" using 1:4 title "dheap add" with lines, \
+     "test-dheap.out" using 1:5 title "dheap del" with lines, \
+     "test-dheap.out" using 1:6 title "dheap fire" with lines, \
+     "test-radix.out" using 1:4 title "radix add" with lines, \
+     "test-radix.out" using 1:5 title "radix del" with lines, \
+     "test-radix.out" using 1:6 title "radix fire" with lines
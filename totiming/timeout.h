@@ -53,6 +53,7 @@
 
 #include "avl.h"
 #include "heap.h"
+#include "mtheap.h"
 struct circq {
 	struct circq *next;		/* next element */
 	struct circq *prev;		/* previous element */
@@ -63,6 +64,9 @@ struct timeout {
 		struct circq to_list;	/* timeout queue, don't move */
 		struct avl_node to_tree;
 		CHEAP_ENTRY(struct timeout) to_heap;
+		DHEAP_ENTRY(struct timeout) to_dheap;
+		RHEAP_ENTRY(struct timeout) to_rheap;
+		SHEAP_ENTRY(struct timeout) to_sheap;
 	};
 	void (*to_func)(void *);	/* function to call */
 	void *to_arg;			/* function argument */
@@ -76,6 +80,8 @@ struct timeout {
 #define TIMEOUT_ONQUEUE		2	/* timeout is on the todo queue */
 #define TIMEOUT_INITIALIZED	4	/* timeout is initialized */
 #define TIMEOUT_TRIGGERED	8	/* timeout is running or ran */
+#define TIMEOUT_BUSY		16	/* timeout is being changed */
+#define TIMEOUT_TODO		32	/* due, off the tree on the todo queue */
 
 #if defined(_KERNEL) || defined(TEST_HARNESS)
 struct bintime;
@@ -85,9 +91,10 @@ struct bintime;
  * timeout_pending(to) - is this timeout already scheduled to run?
  * timeout_initialized(to) - is this timeout initialized?
  */
-#define timeout_pending(to) ((to)->to_flags & TIMEOUT_ONQUEUE)
-#define timeout_initialized(to) ((to)->to_flags & TIMEOUT_INITIALIZED)
-#define timeout_triggered(to) ((to)->to_flags & TIMEOUT_TRIGGERED)
+#define timeout_flags(to) __atomic_load_n(&(to)->to_flags, __ATOMIC_RELAXED)
+#define timeout_pending(to) (timeout_flags(to) & TIMEOUT_ONQUEUE)
+#define timeout_initialized(to) (timeout_flags(to) & TIMEOUT_INITIALIZED)
+#define timeout_triggered(to) (timeout_flags(to) & TIMEOUT_TRIGGERED)
 
 void timeout_set(struct timeout *, void (*)(void *), void *);
 void timeout_add(struct timeout *, int);
@@ -109,6 +116,26 @@ void timeout_startup(void);
 int timeout_hardclock_update(void);
 
 void softclock(void *);
+
+#ifdef TIMEOUT_SHEAP
+/* Assert that the heap is in order, returns the number of timeouts. */
+unsigned long timeout_check(void);
+#endif
+
+#ifdef TIMEOUT_TRACE
+/*
+ * Record the calls in a trace, see totrace.c.
+ */
+int totrace_open(const char *);
+int totrace_close(void);
+void totrace_add(struct timeout *, int);
+int totrace_del(struct timeout *);
+int totrace_hardclock_update(void);
+
+#define timeout_add(to, t) totrace_add(to, t)
+#define timeout_del(to) totrace_del(to)
+#define timeout_hardclock_update() totrace_hardclock_update()
+#endif
 #endif /* _KERNEL */
 
 #endif	/* _SYS_TIMEOUT_H_ */
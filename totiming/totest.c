@@ -6,15 +6,12 @@
 #include <inttypes.h>
 #include <sys/time.h>
 #include <sys/queue.h>
-#include "timeout.h"
-
-#if 0
 #include <sys/resource.h>
-#else
-#ifdef __MACH__
-#include <mach/mach_time.h>
-#endif
-#endif
+#include <unistd.h>
+#include "timeout.h"
+#include "arena.h"
+#include "bench.h"
+#include "trace.h"
 
 int ticks;
 
@@ -29,14 +26,14 @@ random_time(void)
 	 * 25% chance to end up 50-9999
 	 * 25% chance to end up 1000-100k
 	 */
-	switch (arc4random_uniform(4)) {
+	switch (bench_random_uniform(4)) {
 	case 0:
 	case 1:
-		return arc4random_uniform(49) + 1;
+		return bench_random_uniform(49) + 1;
 	case 2:
-		return 50 + arc4random_uniform(1000 - 50);
+		return 50 + bench_random_uniform(1000 - 50);
 	case 3:
-		return 1000 + arc4random_uniform(100000 - 1000);
+		return 1000 + bench_random_uniform(100000 - 1000);
 	}
 	return 0;
 }
@@ -47,7 +44,26 @@ LIST_HEAD(x,myto) active, inactive;
 struct myto {
 	struct timeout to;
 	LIST_ENTRY(myto) list;
-} *timeouts;
+};
+
+/*
+ * The timeouts live in an arena, -M picks huge pages, a NUMA node and
+ * whether they are handed out in random order.
+ */
+struct arena toarena;
+int arena_flags;
+int arena_node = -1;
+
+static void
+tos_alloc(size_t n, size_t size)
+{
+	if (arena_init(&toarena, n, size, arena_flags, arena_node) == -1)
+		err(1, "arena_init");
+	if (arena_flags & ARENA_SHUFFLE)
+		arena_shuffle(&toarena, bench_random());
+}
+
+#define TO(i) ((struct myto *)arena_slot(&toarena, (i)))
 
 int fired;
 
@@ -67,59 +83,65 @@ to_fire(void *v)
 	LIST_INSERT_HEAD(&inactive, to, list);
 }
 
-static uint64_t
-timestamp(void)
+/*
+ * Resident memory in bytes. Without /proc it's the peak, which is
+ * good enough when every run uses more memory than the one before.
+ */
+static long
+rss(void)
 {
-#if 0
+#ifdef __linux__
+	FILE *f;
+	long size, res = 0;
+
+	if ((f = fopen("/proc/self/statm", "r")) != NULL) {
+		if (fscanf(f, "%ld %ld", &size, &res) != 2)
+			res = 0;
+		fclose(f);
+	}
+	return res * sysconf(_SC_PAGESIZE);
+#else
 	struct rusage ru;
+
 	getrusage(RUSAGE_SELF, &ru);
-	return ((uint64_t)ru.ru_utime.tv_sec * 1000000ULL) + (uint64_t)ru.ru_utime.tv_usec;
+#ifdef __MACH__
+	return ru.ru_maxrss;
 #else
-	return mach_absolute_time();
+	return ru.ru_maxrss * 1024L;
 #endif
-}
-
-static double
-ts2ns(uint64_t ts)
-{
-#if 0
-	return (double)ts * 1000.0;
-#else
-	static mach_timebase_info_data_t tb;
-	if (tb.denom == 0)
-		mach_timebase_info(&tb);
-	return ((double)ts * (double)tb.numer / (double)tb.denom);
 #endif
 }
 
 void
 run_one(int nto, int nevents) {
 	uint64_t start, end;
-	uint64_t fs, as, ds;
+	uint64_t fs, as, ds, us;
 	uint64_t s;
 	struct myto *to;
 	double elapsed;
 	int deleted;
 	int added;
+	int updated;
 	int i;
 	int rt;
+	long r;
 
-	if ((timeouts = calloc(nto, sizeof(*timeouts))) == NULL)
-		err(1, "calloc");
+	r = rss();
+	tos_alloc(nto, sizeof(struct myto));
 
 	LIST_INIT(&active);
 	LIST_INIT(&inactive);
 
 	for (i = 0; i < nto; i++) {
-		timeout_set(&timeouts[i].to, to_fire, &timeouts[i].to);
-		LIST_INSERT_HEAD(&inactive, &timeouts[i], list);
+		timeout_set(&TO(i)->to, to_fire, &TO(i)->to);
+		LIST_INSERT_HEAD(&inactive, TO(i), list);
 	}
 
-	fs = as = ds = 0;
+	fs = as = ds = us = 0;
 
-	added = deleted = fired = 0;
+	added = updated = deleted = fired = 0;
 
-	start = timestamp();
+	start = bench_now();
 
 	for (i = 0; i < nevents; i++) {
 		struct myto *to;
@@ -129,13 +151,13 @@ run_one(int nto, int nevents) {
 		 * 30% chance to remove one.
 		 * 10% chance to fire softclock.
 		 */
-		switch(arc4random_uniform(10)) {
+		switch(bench_random_uniform(10)) {
 		case 0:
 			fired++;
-			s = timestamp();
+			s = bench_now();
 			if (timeout_hardclock_update())
 				softclock(NULL);
-			fs += timestamp() - s;
+			fs += bench_since(s);
 			break;
 		case 1:
 		case 2:
@@ -143,9 +165,9 @@ run_one(int nto, int nevents) {
 				LIST_REMOVE(to, list);
 				LIST_INSERT_HEAD(&inactive, to, list);
 				deleted++;
-				s = timestamp();
+				s = bench_now();
 				timeout_del(&to->to);
-				ds += timestamp() - s;
+				ds += bench_since(s);
 			}
 			break;
 		case 3:
@@ -155,30 +177,132 @@ run_one(int nto, int nevents) {
 		case 7:
 		case 8:
 		case 9:
-			added++;
-			to = &timeouts[arc4random_uniform(nto)];
+			to = TO(bench_random_uniform(nto));
 			LIST_REMOVE(to, list);
 			LIST_INSERT_HEAD(&active, to, list);
 			rt = random_time();
-			s = timestamp();
-			timeout_add(&to->to, rt);
-			as += timestamp() - s;
+			/*
+			 * Adding a timeout that's already scheduled is
+			 * an update, count it separately.
+			 */
+			if (timeout_pending(&to->to)) {
+				updated++;
+				s = bench_now();
+				timeout_add(&to->to, rt);
+				us += bench_since(s);
+			} else {
+				added++;
+				s = bench_now();
+				timeout_add(&to->to, rt);
+				as += bench_since(s);
+			}
 			break;
 		}
 	}
-	end = timestamp();
+	end = bench_now();
+	r = rss() - r;
 
 
-#define av(at,s) (ts2ns(at) / (double)s)
-	elapsed = ts2ns(end - start);
+#define av(at,s) ((s) ? bench_ns(at) / (double)(s) : 0.0)
+	elapsed = bench_ns(end - start);
 
-	printf("%d %d %f %f %f %f\n", nto, nevents, elapsed / 1000000000.0, av(as, added), av(ds, deleted), av(fs, fired));
+	printf("%d %d %f %f %f %f %f %f\n", nto, nevents, elapsed / 1000000000.0, av(as, added), av(ds, deleted), av(fs, fired), av(us, updated), (double)r / nto);
 	fflush(stdout);
 
 	LIST_FOREACH(to, &active, list) {
 		timeout_del(&to->to);
 	}
-	free(timeouts);
+	arena_fini(&toarena);
+}
+
+/*
+ * A timeout added for 0 ticks fires on the next tick, one late.
+ */
+static void
+replay_fire(void *v)
+{
+	struct timeout *to = v;
+
+	assert(to->to_time - ticks <= 0);
+}
+
+/*
+ * Feed a trace to timeout_add/del and the clock. The same columns as
+ * run_one, nto is the number of timeouts in the trace and nevents the
+ * number of records.
+ */
+void
+replay_one(const struct trace *t)
+{
+	const struct trace_rec *tr, *last = t->t_rec + t->t_nrec;
+	struct timeout *to;
+	uint64_t start, end;
+	uint64_t fs, as, ds, us;
+	uint64_t s;
+	double elapsed;
+	int added, updated, deleted, nticks;
+	uint32_t i;
+	int n;
+	long r;
+
+	r = rss();
+	tos_alloc(t->t_nid + 1, sizeof(struct timeout));
+	for (i = 0; i < t->t_nid; i++) {
+		to = arena_slot(&toarena, i);
+		timeout_set(to, replay_fire, to);
+	}
+
+	fs = as = ds = us = 0;
+	added = updated = deleted = nticks = 0;
+
+	start = bench_now();
+	for (tr = t->t_rec; tr < last; tr++) {
+		switch (TRACE_OP(tr)) {
+		case TRACE_INSERT:
+		case TRACE_UPDATE:
+			assert(TRACE_ID(tr) < t->t_nid);
+			to = arena_slot(&toarena, TRACE_ID(tr));
+			if (timeout_pending(to)) {
+				updated++;
+				s = bench_now();
+				timeout_add(to, tr->tr_key);
+				us += bench_since(s);
+			} else {
+				added++;
+				s = bench_now();
+				timeout_add(to, tr->tr_key);
+				as += bench_since(s);
+			}
+			break;
+		case TRACE_REMOVE:
+			assert(TRACE_ID(tr) < t->t_nid);
+			deleted++;
+			s = bench_now();
+			timeout_del(arena_slot(&toarena, TRACE_ID(tr)));
+			ds += bench_since(s);
+			break;
+		case TRACE_TICK:
+			for (n = tr->tr_key; n > 0; n--) {
+				nticks++;
+				s = bench_now();
+				if (timeout_hardclock_update())
+					softclock(NULL);
+				fs += bench_since(s);
+			}
+			break;
+		}
+	}
+	end = bench_now();
+	r = rss() - r;
+
+	elapsed = bench_ns(end - start);
+
+	printf("%u %llu %f %f %f %f %f %f\n", t->t_nid, (unsigned long long)t->t_nrec, elapsed / 1000000000.0, av(as, added), av(ds, deleted), av(fs, nticks), av(us, updated), (double)r / t->t_nid);
+	fflush(stdout);
+
+	for (i = 0; i < t->t_nid; i++)
+		timeout_del(arena_slot(&toarena, i));
+	arena_fini(&toarena);
 }
 
 #ifndef nitems
@@ -188,18 +312,76 @@ int test_tos[] = {
 	10, 20, 50, 100, 200, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000
 };
 
+static void
+usage(void)
+{
+#ifdef TIMEOUT_TRACE
+	fprintf(stderr, "usage: totest [-M mem] [-r trace] [-s seed] [-T timer] [-w trace]\n    [nto nevents]\n");
+#else
+	fprintf(stderr, "usage: totest [-M mem] [-r trace] [-s seed] [-T timer] [nto nevents]\n");
+#endif
+	exit(1);
+}
+
 int
 main(int argc, char **argv)
 {
+	const char *timer = NULL, *trace = NULL;
+	struct trace t;
 	int nevents, nto;
-	int i;
+	int i, ch;
+
+	while ((ch = getopt(argc, argv, "M:r:s:T:w:")) != -1) {
+		switch (ch) {
+		case 'M':
+			/* thp,hugetlb,shuffle,node=N */
+			if (arena_parse(optarg, &arena_flags, &arena_node) == -1)
+				usage();
+			break;
+		case 'r':
+			trace = optarg;
+			break;
+		case 's':
+			bench_seed(strtoull(optarg, NULL, 0));
+			break;
+		case 'T':
+			timer = optarg;
+			break;
+#ifdef TIMEOUT_TRACE
+		case 'w':
+			/* Record what we do. */
+			if (totrace_open(optarg) == -1)
+				err(1, "%s", optarg);
+			break;
+#endif
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (bench_timer_init(timer) == -1)
+		errx(1, "timer %s not available", timer);
 
 	timeout_startup();
 
-	if (argc == 3) {
-		nto = atoi(argv[1]);
-		nevents = atoi(argv[2]);
+	if (trace != NULL) {
+		if (trace_open(&t, trace) == -1)
+			err(1, "%s", trace);
+		replay_one(&t);
+		trace_close(&t);
+		return 0;
+	}
+
+	if (argc == 2) {
+		nto = atoi(argv[0]);
+		nevents = atoi(argv[1]);
 		run_one(nto, nevents);
+#ifdef TIMEOUT_TRACE
+		if (totrace_close() == -1)
+			err(1, "totrace_close");
+#endif
 		return 0;
 	}
 
@@ -211,6 +393,10 @@ main(int argc, char **argv)
 			run_one(((test_tos[i + 1] - test_tos[i]) / steps) * j + test_tos[i], 1000000);
 		}
 	}
+#ifdef TIMEOUT_TRACE
+	if (totrace_close() == -1)
+		err(1, "totrace_close");
+#endif
 
 	return 0;
 }
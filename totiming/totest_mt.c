@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "timeout.h"
+
+/*
+ * The sharded timeouts from many threads at once. Every thread adds and
+ * deletes random timeouts out of one pool while another thread runs the
+ * clock, so a timeout is moved and deleted from other shards than the
+ * one it's on, and there are more threads than shards. After every
+ * round everything stops and timeout_check goes through the heaps.
+ */
+
+int ticks;
+
+struct mto {
+	struct timeout to;
+	int fired;
+};
+
+static inline uint32_t
+thr_random(void)
+{
+	static __thread uint32_t x;
+
+	if (x == 0)
+		x = (uint32_t)(uintptr_t)&x | 1;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+static void
+mto_fire(void *arg)
+{
+	struct mto *m = arg;
+
+	if (m->to.to_time - ticks > 0)
+		errx(1, "timeout fired early");
+	__atomic_add_fetch(&m->fired, 1, __ATOMIC_RELAXED);
+}
+
+struct mto *pool;
+int npool, nops;
+static volatile int stop;
+
+static void *
+thr_run(void *arg)
+{
+	struct mto *m;
+	int i;
+
+	for (i = 0; i < nops; i++) {
+		m = &pool[thr_random() % npool];
+		if (thr_random() % 3)
+			timeout_add(&m->to, thr_random() % 100);
+		else
+			timeout_del(&m->to);
+	}
+	return NULL;
+}
+
+static void *
+clock_run(void *arg)
+{
+	while (!stop) {
+		if (timeout_hardclock_update())
+			softclock(NULL);
+	}
+	return NULL;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: totest-mt [-o nops] [-p npool] [-r rounds] [-t threads]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t *thr, clk;
+	int nthreads = 12, rounds = 10;
+	unsigned long fired, pending, n;
+	int ch, i, r;
+
+	npool = 1000;
+	nops = 20000;
+	while ((ch = getopt(argc, argv, "o:p:r:t:")) != -1) {
+		switch (ch) {
+		case 'o':
+			nops = atoi(optarg);
+			break;
+		case 'p':
+			npool = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (npool < 1 || nthreads < 1)
+		usage();
+
+	if ((pool = calloc(npool, sizeof(*pool))) == NULL ||
+	    (thr = calloc(nthreads, sizeof(*thr))) == NULL)
+		err(1, "calloc");
+
+	timeout_startup();
+	for (i = 0; i < npool; i++)
+		timeout_set(&pool[i].to, mto_fire, &pool[i]);
+
+	for (r = 0; r < rounds; r++) {
+		stop = 0;
+		if (pthread_create(&clk, NULL, clock_run, NULL))
+			errx(1, "pthread_create");
+		for (i = 0; i < nthreads; i++)
+			if (pthread_create(&thr[i], NULL, thr_run, NULL))
+				errx(1, "pthread_create");
+		for (i = 0; i < nthreads; i++)
+			pthread_join(thr[i], NULL);
+		stop = 1;
+		pthread_join(clk, NULL);
+
+		n = timeout_check();
+		pending = fired = 0;
+		for (i = 0; i < npool; i++) {
+			if (timeout_pending(&pool[i].to))
+				pending++;
+			fired += pool[i].fired;
+		}
+		if (n != pending)
+			errx(1, "round %d: %lu on the heap, %lu pending",
+			    r, n, pending);
+		printf("%d %lu %lu\n", r, pending, fired);
+	}
+
+	return 0;
+}
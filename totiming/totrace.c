@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2026 Artur Grabowski <art@blahonga.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Records the timeout calls of a program in a trace that totest and
+ * heap_test can replay. Build the program with -DTIMEOUT_TRACE, which
+ * turns timeout_add, timeout_del and timeout_hardclock_update into
+ * the functions here, and link it with this file, trace.o and one of
+ * the kern_timeout implementations. Only the program gets the define,
+ * this file and kern_timeout call the real functions, but in case
+ * the define leaks in here we undo it. Only those three calls are
+ * recorded, the timeout_add_* variants are not.
+ *
+ * Timeouts are numbered in the order we first see them.
+ */
+
+#include <sys/time.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "timeout.h"
+#include "trace.h"
+
+#undef timeout_add
+#undef timeout_del
+#undef timeout_hardclock_update
+
+static struct trace_writer tw;
+static int recording;
+
+/* Ticks not written yet, runs of ticks are one record. */
+static int32_t pending_ticks;
+
+/* Open addressing from timeout to id. */
+static struct toid {
+	struct timeout *to;
+	uint32_t id;
+} *toids;
+static size_t ntoids;
+static uint32_t nextid;
+
+static size_t
+toid_hash(struct timeout *to, size_t n)
+{
+	return ((uintptr_t)to >> 3) * 0x9e3779b97f4a7c15ULL & (n - 1);
+}
+
+static void
+toid_grow(void)
+{
+	struct toid *old = toids;
+	size_t i, j, n = ntoids;
+
+	ntoids = n ? n * 2 : 1024;
+	if ((toids = calloc(ntoids, sizeof(*toids))) == NULL)
+		err(1, "totrace");
+	for (i = 0; i < n; i++) {
+		if (old[i].to == NULL)
+			continue;
+		for (j = toid_hash(old[i].to, ntoids); toids[j].to != NULL;
+		    j = (j + 1) & (ntoids - 1))
+			;
+		toids[j] = old[i];
+	}
+	free(old);
+}
+
+static uint32_t
+toid(struct timeout *to)
+{
+	size_t i;
+
+	if (nextid >= ntoids / 2)
+		toid_grow();
+	for (i = toid_hash(to, ntoids); toids[i].to != NULL;
+	    i = (i + 1) & (ntoids - 1))
+		if (toids[i].to == to)
+			return toids[i].id;
+	if (nextid > TRACE_MAXID)
+		errx(1, "totrace: too many timeouts");
+	toids[i].to = to;
+	toids[i].id = nextid++;
+	return toids[i].id;
+}
+
+static void
+flush_ticks(void)
+{
+	if (pending_ticks) {
+		trace_write(&tw, TRACE_TICK, 0, pending_ticks);
+		pending_ticks = 0;
+	}
+}
+
+int
+totrace_open(const char *path)
+{
+	if (trace_writer_open(&tw, path) == -1)
+		return -1;
+	recording = 1;
+	return 0;
+}
+
+int
+totrace_close(void)
+{
+	if (!recording)
+		return 0;
+	flush_ticks();
+	recording = 0;
+	free(toids);
+	toids = NULL;
+	ntoids = nextid = 0;
+	return trace_writer_close(&tw);
+}
+
+void
+totrace_add(struct timeout *to, int to_ticks)
+{
+	if (recording) {
+		flush_ticks();
+		trace_write(&tw, timeout_pending(to) ? TRACE_UPDATE :
+		    TRACE_INSERT, toid(to), to_ticks);
+	}
+	timeout_add(to, to_ticks);
+}
+
+int
+totrace_del(struct timeout *to)
+{
+	if (recording && timeout_pending(to)) {
+		flush_ticks();
+		trace_write(&tw, TRACE_REMOVE, toid(to), 0);
+	}
+	return timeout_del(to);
+}
+
+int
+totrace_hardclock_update(void)
+{
+	if (recording)
+		pending_ticks++;
+	return timeout_hardclock_update();
+}